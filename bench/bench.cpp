@@ -0,0 +1,389 @@
+/***
+ *       Filename:  bench.cpp
+ *
+ *    Description:  Speed and accuracy benchmark on synthetic recordings with
+ *                  known motion.
+ *
+ *        Version:  0.0.1
+ *        Created:  2016-10-26
+ *       Revision:  none
+ *
+ *         Author:  Dilawar Singh <dilawars@ncbs.res.in>
+ *   Organization:  NCBS Bangalore
+ *
+ *        License:  GNU GPL2
+ **/
+
+#include <opencv2/opencv.hpp>
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <cstdio>
+#include "videoio.h"
+#include "stablizer.h"
+#include "parallel.h"
+#include "metrics.h"
+#include "globals.h"
+#include "tclap/CmdLine.h"
+
+#include "easylogging++.h"
+INITIALIZE_EASYLOGGINGPP
+
+using namespace std;
+using namespace cv;
+
+// Stages reported for every run, in pipeline order.
+static const char* STAGES[] = {
+    "read", "prefilter", "pyramid", "detect", "track", "estimate", "smooth", "warp"
+        , "write"
+};
+
+/**
+ * @brief Parameters of a synthetic recording.
+ */
+struct SyntheticConfig
+{
+    int size = 512;
+    size_t numFrames = 100;
+    int depth = CV_8U;
+    double noise = 5.0;                         /* Std. of noise, of 255. */
+    double shiftStep = 1.0;                     /* Std. of the drift per frame, px. */
+    double rotationStep = 0.05;                 /* Std. of the rotation per frame, degree. */
+    unsigned seed = 1;
+};
+
+struct Cell
+{
+    Point2f centre;
+    float radius;
+    float baseline;
+};
+
+/**
+ * @brief Transform from scene to frame: rotation by angle about the frame
+ * centre, then a shift.
+ */
+static Mat scene_to_frame( double dx, double dy, double angle, Point2f centre, int margin )
+{
+    double c = cos( angle ), s = sin( angle );
+    Mat M = Mat::eye( 3, 3, CV_64F );
+    M.at<double>( 0, 0 ) = c;
+    M.at<double>( 0, 1 ) = -s;
+    M.at<double>( 1, 0 ) = s;
+    M.at<double>( 1, 1 ) = c;
+
+    // p_frame = R ( p_scene - margin - centre ) + centre + shift
+    Point2f o( centre.x + margin, centre.y + margin );
+    M.at<double>( 0, 2 ) = centre.x + dx - ( c * o.x - s * o.y );
+    M.at<double>( 1, 2 ) = centre.y + dy - ( s * o.x + c * o.y );
+    return M;
+}
+
+/**
+ * @brief Calcium imaging like stack: blurred cells of random size and
+ * baseline on a dim background, with random transients, drifting and
+ * rotating by a random walk, plus Gaussian noise.
+ *
+ * @param cfg
+ * @param frames
+ * @param truth prev to cur transform of every pair of frames.
+ */
+static void make_synthetic_stack( const SyntheticConfig& cfg
+        , vector< Mat >& frames
+        , vector< TransformParam >& truth
+        )
+{
+    RNG rng( cfg.seed );
+    int margin = cfg.size / 4;
+    int sceneSize = cfg.size + 2 * margin;
+    Point2f centre( cfg.size / 2.0f, cfg.size / 2.0f );
+
+    vector< Cell > cells( sceneSize * sceneSize / 600 );
+    for( auto& c : cells )
+    {
+        c.centre = Point2f( rng.uniform( 0, sceneSize ), rng.uniform( 0, sceneSize ) );
+        c.radius = rng.uniform( 3.0f, 8.0f );
+        c.baseline = rng.uniform( 40.0f, 120.0f );
+    }
+    vector< float > activity( cells.size( ), 0.0f );
+
+    double maxValue = cfg.depth == CV_16U ? 65535.0 : 255.0;
+    double dx = 0, dy = 0, angle = 0;
+    Mat prevM;
+    frames.clear( );
+    truth.clear( );
+    for (size_t k = 0; k < cfg.numFrames; k++)
+    {
+        Mat scene( sceneSize, sceneSize, CV_32F, Scalar( 20 ) );
+        for (size_t i = 0; i < cells.size( ); i++)
+        {
+            // Transients rise at once and decay exponentially.
+            activity[i] *= 0.9f;
+            if( rng.uniform( 0.0, 1.0 ) < 0.01 )
+                activity[i] += rng.uniform( 1.0f, 3.0f );
+
+            const Cell& c = cells[i];
+            circle( scene, c.centre, c.radius
+                    , Scalar( c.baseline * ( 1.0f + activity[i] ) ), -1
+                    );
+        }
+        GaussianBlur( scene, scene, Size( 0, 0 ), 1.5 );
+
+        Mat M = scene_to_frame( dx, dy, angle, centre, margin );
+        Mat frame;
+        warpAffine( scene, frame, M( Rect( 0, 0, 3, 2 ) ), Size( cfg.size, cfg.size ) );
+
+        Mat noise( frame.size( ), CV_32F );
+        randn( noise, 0, cfg.noise );
+        frame += noise;
+        frame.convertTo( frame, cfg.depth, maxValue / 255.0 );
+        frames.push_back( frame );
+
+        if( prevM.data )
+        {
+            Mat T = M * prevM.inv( );
+            truth.push_back( TransformParam( T.at<double>( 0, 2 ), T.at<double>( 1, 2 )
+                        , atan2( T.at<double>( 1, 0 ), T.at<double>( 0, 0 ) )
+                        ) );
+        }
+        prevM = M;
+
+        dx += rng.gaussian( cfg.shiftStep );
+        dy += rng.gaussian( cfg.shiftStep );
+        angle += rng.gaussian( cfg.rotationStep * CV_PI / 180.0 );
+    }
+}
+
+struct BenchResult
+{
+    double seconds = 0;
+    double translationError = 0;                /* RMS, px. */
+    double rotationError = 0;                   /* RMS, degree. */
+    double drift = 0;                           /* Accumulated at the last frame, px. */
+    map< string, StageStats > stages;
+};
+
+/**
+ * @brief Read, stabilize and write infile, timing every stage, and compare
+ * the estimated transforms with truth.
+ */
+static BenchResult run_once( const string& infile, const string& outfile
+        , const vector< TransformParam >& truth
+        )
+{
+    BenchResult r;
+    reset_stage_stats( );
+    auto start = chrono::steady_clock::now( );
+
+    video_info_t vInfo;
+    vector< Mat > frames;
+    read_frames( infile, frames, vInfo );
+
+    vector< TransformParam > transforms, corrections;
+    estimate_transforms( frames, transforms );
+    corrections_from_transforms( transforms, corrections );
+
+    vector< Mat > result;
+    apply_corrections( frames, corrections, result );
+    write_frames( outfile, result, infile );
+
+    r.seconds = chrono::duration< double >( chrono::steady_clock::now( ) - start ).count( );
+    r.stages = stage_stats( );
+
+    double ex = 0, ey = 0;
+    size_t n = min( transforms.size( ), truth.size( ) );
+    for (size_t k = 0; k < n; k++)
+    {
+        double tx = transforms[k].dx - truth[k].dx;
+        double ty = transforms[k].dy - truth[k].dy;
+        double ta = transforms[k].da - truth[k].da;
+        r.translationError += tx * tx + ty * ty;
+        r.rotationError += ta * ta;
+        ex += tx;
+        ey += ty;
+    }
+    if( n > 0 )
+    {
+        r.translationError = sqrt( r.translationError / n );
+        r.rotationError = sqrt( r.rotationError / n ) * 180.0 / CV_PI;
+    }
+    r.drift = hypot( ex, ey );
+    return r;
+}
+
+static void print_header( )
+{
+    std::cout << setw( 6 ) << "size" << setw( 8 ) << "threads" << setw( 9 ) << "fps";
+    for( auto s : STAGES )
+        std::cout << setw( 10 ) << s;
+    std::cout << setw( 10 ) << "err(px)" << setw( 10 ) << "err(deg)"
+        << setw( 10 ) << "drift(px)" << std::endl;
+}
+
+static void print_result( int size, size_t threads, size_t numFrames, const BenchResult& r )
+{
+    std::cout << fixed << setprecision( 1 )
+        << setw( 6 ) << size << setw( 8 ) << threads
+        << setw( 9 ) << numFrames / r.seconds << setprecision( 3 );
+    for( auto s : STAGES )
+    {
+        auto it = r.stages.find( s );
+        std::cout << setw( 10 ) << ( it == r.stages.end( ) ? 0.0 : it->second.seconds );
+    }
+    std::cout << setw( 10 ) << r.translationError << setw( 10 ) << r.rotationError
+        << setw( 10 ) << r.drift << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    SyntheticConfig cfg;
+    vector< int > sizes = { 256, 512, 1024 };
+    vector< size_t > threads = { 1, 0 };
+    string workdir = "/tmp";
+    bool keep = false;
+
+    el::Configurations defaultConf;
+    defaultConf.setToDefault( );
+    defaultConf.setGlobally( el::ConfigurationType::Format, "%datetime %msg" );
+    el::Loggers::reconfigureLogger( "default", defaultConf );
+
+    try {
+
+        TCLAP::CmdLine cmd("Benchmark videostab on synthetic recordings with known motion."
+                , ' ', "0.1.0");
+
+        TCLAP::MultiArg<int> sizeArg ("s", "size"
+                , "Frame size (square) in pixels. Repeat for several sizes"
+                " (default 256, 512 and 1024)."
+                , false , "pixels"
+                );
+        cmd.add( sizeArg );
+
+        TCLAP::MultiArg<size_t> threadsArg ("j", "threads"
+                , "Number of threads, 0 for one per core. Repeat for several"
+                " (default 1 and 0)."
+                , false , "non-negative integer"
+                );
+        cmd.add( threadsArg );
+
+        TCLAP::ValueArg<size_t> framesArg ("f", "frames"
+                , "Number of frames (default 100)."
+                , false , cfg.numFrames , "positive integer"
+                );
+        cmd.add( framesArg );
+
+        TCLAP::ValueArg<int> depthArg ("d", "depth"
+                , "Bits per pixel, 8 or 16 (default 8)."
+                , false , 8 , "8 or 16"
+                );
+        cmd.add( depthArg );
+
+        TCLAP::ValueArg<double> noiseArg ("", "noise"
+                , "Std. of the Gaussian noise, of 255 (default 5)."
+                , false , cfg.noise , "float"
+                );
+        cmd.add( noiseArg );
+
+        TCLAP::ValueArg<double> shiftArg ("", "shift"
+                , "Std. of the drift per frame in pixels (default 1)."
+                , false , cfg.shiftStep , "float"
+                );
+        cmd.add( shiftArg );
+
+        TCLAP::ValueArg<double> rotationArg ("", "rotation"
+                , "Std. of the rotation per frame in degree (default 0.05)."
+                , false , cfg.rotationStep , "float"
+                );
+        cmd.add( rotationArg );
+
+        TCLAP::ValueArg<unsigned> seedArg ("", "seed"
+                , "Seed of the random generator (default 1)."
+                , false , cfg.seed , "integer"
+                );
+        cmd.add( seedArg );
+
+        vector< string > estimatorNames = { "features", "phase" };
+        TCLAP::ValuesConstraint< string > estimatorConstraint( estimatorNames );
+        TCLAP::ValueArg<string> estimatorArg ("e", "estimator"
+                , "Motion estimator (default features)."
+                , false , "features" , &estimatorConstraint
+                );
+        cmd.add( estimatorArg );
+
+        vector< string > prefilterNames = { "bilateral", "gaussian", "none" };
+        TCLAP::ValuesConstraint< string > prefilterConstraint( prefilterNames );
+        TCLAP::ValueArg<string> prefilterArg ("", "prefilter"
+                , "Denoising before corners are tracked (default bilateral)."
+                , false , "bilateral" , &prefilterConstraint
+                );
+        cmd.add( prefilterArg );
+
+        TCLAP::ValueArg<std::string> workdirArg ("w", "workdir"
+                , "Directory for the synthetic recordings (default /tmp)."
+                , false , workdir , "directory"
+                );
+        cmd.add( workdirArg );
+
+        TCLAP::SwitchArg keepArg("k", "keep"
+                , "Keep the synthetic recordings and the stabilized output."
+                , cmd, false);
+
+        cmd.parse( argc, argv );
+
+        if( sizeArg.isSet( ) )
+            sizes = sizeArg.getValue( );
+        if( threadsArg.isSet( ) )
+            threads = threadsArg.getValue( );
+        cfg.numFrames = framesArg.getValue( );
+        cfg.depth = depthArg.getValue( ) == 16 ? CV_16U : CV_8U;
+        cfg.noise = noiseArg.getValue( );
+        cfg.shiftStep = shiftArg.getValue( );
+        cfg.rotationStep = rotationArg.getValue( );
+        cfg.seed = seedArg.getValue( );
+        estimator_name_ = estimatorArg.getValue( );
+        prefilter_name_ = prefilterArg.getValue( );
+        workdir = workdirArg.getValue( );
+        keep = keepArg.getValue( );
+    }
+    catch (TCLAP::ArgException &e)
+    {
+        std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+        return 1;
+    }
+
+    // The synthetic stacks have no black border to crop.
+    border_crop_ = 0;
+
+    std::cout << "[INFO] " << cfg.numFrames << " frames per stack, estimator "
+        << estimator_name_ << ", prefilter " << prefilter_name_ << ". Stage columns are seconds summed over threads."
+        << std::endl;
+    print_header( );
+
+    for( int size : sizes )
+    {
+        cfg.size = size;
+        vector< Mat > frames;
+        vector< TransformParam > truth;
+        make_synthetic_stack( cfg, frames, truth );
+
+        string infile = workdir + "/__bench_" + to_string( size ) + ".tif";
+        string outfile = workdir + "/__bench_" + to_string( size ) + "_corrected.tif";
+        write_frames_to_tiff( infile, frames, "" );
+        frames.clear( );
+
+        for( size_t n : threads )
+        {
+            set_num_threads( n );
+            BenchResult r = run_once( infile, outfile, truth );
+            print_result( size, get_num_threads( ), cfg.numFrames, r );
+        }
+
+        if( ! keep )
+        {
+            remove( infile.c_str( ) );
+            remove( ( infile + ".ifdx" ).c_str( ) );
+            remove( outfile.c_str( ) );
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,235 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  arrayfile.cpp
+ *
+ *    Description:  Stack of frames in a memory-mapped .npy or raw file, for
+ *                  analysis tools which map the result instead of decoding
+ *                  it.
+ *
+ *        Version:  1.0
+ *        Created:  11/28/2016 03:12:45 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#include "arrayfile.h"
+#include "videoio.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// The NPY header is padded to this many bytes, so that it can be rewritten
+// in place with the final number of frames, and the pixels stay aligned.
+const size_t NPY_HEADER_BYTES = 128;
+
+static bool little_endian( )
+{
+    const uint16_t one = 1;
+    return *( const uint8_t* ) &one == 1;
+}
+
+/**
+ * @brief numpy type string of an OpenCV depth, e.g. <u2 for CV_16U.
+ */
+static string npy_descr( int type )
+{
+    string order = little_endian( ) ? "<" : ">";
+    switch( CV_MAT_DEPTH( type ) )
+    {
+        case CV_8U: return "|u1";
+        case CV_8S: return "|i1";
+        case CV_16U: return order + "u2";
+        case CV_16S: return order + "i2";
+        case CV_32S: return order + "i4";
+        case CV_32F: return order + "f4";
+        default: return order + "f8";
+    }
+}
+
+static string dtype_name( int type )
+{
+    switch( CV_MAT_DEPTH( type ) )
+    {
+        case CV_8U: return "uint8";
+        case CV_8S: return "int8";
+        case CV_16U: return "uint16";
+        case CV_16S: return "int16";
+        case CV_32S: return "int32";
+        case CV_32F: return "float32";
+        default: return "float64";
+    }
+}
+
+bool is_array_file( const string& filename )
+{
+    string ext = file_extension( filename );
+    return ext == "npy" || ext == "raw";
+}
+
+string array_sidecar( const string& filename )
+{
+    if( ! is_array_file( filename ) || file_extension( filename ) == "npy" )
+        return "";
+    return filename + ".json";
+}
+
+/*-----------------------------------------------------------------------------
+ *  ArrayFile
+ *-----------------------------------------------------------------------------*/
+ArrayFile::ArrayFile( ) :
+    npy_( false )
+    , fd_( -1 )
+    , data_( NULL )
+    , size_( 0 )
+    , numFrames_( 0 )
+    , type_( CV_8UC1 )
+{
+}
+
+ArrayFile::~ArrayFile( )
+{
+    close( );
+}
+
+bool ArrayFile::create( const string& filename, size_t numFrames, Size frameSize, int type )
+{
+    close( );
+
+    filename_ = filename;
+    npy_ = ( file_extension( filename ) == "npy" );
+    frameSize_ = frameSize;
+    type_ = type;
+
+    fd_ = ::open( filename.c_str( ), O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if( fd_ < 0 )
+    {
+        std::cout << "[WARN] Could not create " << filename << std::endl;
+        return false;
+    }
+    return resize( numFrames );
+}
+
+bool ArrayFile::resize( size_t numFrames )
+{
+    if( fd_ < 0 )
+        return false;
+
+    // The header is only written on close( ), make sure it will fit.
+    if( npy_ && npy_dict( numFrames ).size( ) > NPY_HEADER_BYTES - 10 - 1 )
+    {
+        std::cout << "[WARN] Shape of " << filename_ << " does not fit in its"
+            << " header." << std::endl;
+        return false;
+    }
+
+    unmap( );
+    numFrames_ = numFrames;
+    size_ = ( npy_ ? NPY_HEADER_BYTES : 0 )
+        + numFrames * frameSize_.area( ) * CV_ELEM_SIZE( type_ );
+    if( ftruncate( fd_, size_ ) != 0 )
+    {
+        std::cout << "[WARN] Could not resize " << filename_ << " to " << size_
+            << " bytes." << std::endl;
+        return false;
+    }
+    return map( );
+}
+
+bool ArrayFile::map( )
+{
+    if( size_ == 0 )
+        return true;
+
+    void* addr = mmap( NULL, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0 );
+    if( addr == MAP_FAILED )
+    {
+        std::cout << "[WARN] Could not map " << filename_ << std::endl;
+        return false;
+    }
+    data_ = ( uchar* ) addr;
+    return true;
+}
+
+void ArrayFile::unmap( )
+{
+    if( data_ )
+        munmap( data_, size_ );
+    data_ = NULL;
+}
+
+Mat ArrayFile::frame( size_t k )
+{
+    size_t frameBytes = frameSize_.area( ) * CV_ELEM_SIZE( type_ );
+    uchar* p = data_ + ( npy_ ? NPY_HEADER_BYTES : 0 ) + k * frameBytes;
+    return Mat( frameSize_, type_, p );
+}
+
+string ArrayFile::shape( size_t numFrames ) const
+{
+    ostringstream shape;
+    shape << numFrames << ", " << frameSize_.height << ", " << frameSize_.width;
+    if( CV_MAT_CN( type_ ) > 1 )
+        shape << ", " << CV_MAT_CN( type_ );
+    return shape.str( );
+}
+
+string ArrayFile::npy_dict( size_t numFrames ) const
+{
+    return "{'descr': '" + npy_descr( type_ ) + "', 'fortran_order': False,"
+        " 'shape': (" + shape( numFrames ) + "), }";
+}
+
+void ArrayFile::write_header( )
+{
+    if( ! npy_ )
+    {
+        ofstream json( array_sidecar( filename_ ) );
+        json << "{\"shape\": [" << shape( numFrames_ ) << "], \"dtype\": \""
+            << dtype_name( type_ ) << "\", \"byte_order\": \""
+            << ( little_endian( ) ? "little" : "big" ) << "\", \"offset\": 0}"
+            << endl;
+        return;
+    }
+
+    // Magic, version 1.0, length of the dictionary, then the dictionary padded
+    // with spaces and ending in a newline. resize( ) made sure it fits.
+    string dict = npy_dict( numFrames_ );
+    dict.resize( NPY_HEADER_BYTES - 10 - 1, ' ' );
+    dict += '\n';
+
+    uint16_t len = dict.size( );
+    uchar header[NPY_HEADER_BYTES];
+    memcpy( header, "\x93NUMPY\x01\x00", 8 );
+    header[8] = len & 0xff;
+    header[9] = len >> 8;
+    memcpy( header + 10, dict.data( ), dict.size( ) );
+
+    if( data_ )
+        memcpy( data_, header, NPY_HEADER_BYTES );
+    else if( pwrite( fd_, header, NPY_HEADER_BYTES, 0 ) != ( ssize_t ) NPY_HEADER_BYTES )
+        std::cout << "[WARN] Could not write the header of " << filename_ << std::endl;
+}
+
+void ArrayFile::close( )
+{
+    if( fd_ < 0 )
+        return;
+
+    write_header( );
+    unmap( );
+    ::close( fd_ );
+    fd_ = -1;
+}
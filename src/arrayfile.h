@@ -0,0 +1,93 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  arrayfile.h
+ *
+ *    Description:  Stack of frames in a memory-mapped .npy or raw file, for
+ *                  analysis tools which map the result instead of decoding
+ *                  it.
+ *
+ *        Version:  1.0
+ *        Created:  11/28/2016 03:12:45 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#ifndef  arrayfile_INC
+#define  arrayfile_INC
+
+#include "globals.h"
+
+/**
+ * @brief Frames stored one after the other, in C order, in a file which is
+ * mapped into memory while it is written.
+ *
+ * .npy files get a NPY 1.0 header with shape (frames, rows, cols) and the
+ * dtype, and can be opened with numpy.load( f, mmap_mode='r' ). Any other
+ * file (e.g. .raw) holds only the pixels, with shape, dtype and byte order in
+ * filename.json next to it.
+ *
+ * frame( k ) is a view of frame k inside the mapping: warping or copying into
+ * it writes the file directly, and threads may fill different frames without
+ * locking.
+ */
+class ArrayFile
+{
+public:
+    ArrayFile( );
+    ~ArrayFile( );
+
+    bool create( const string& filename, size_t numFrames, Size frameSize, int type );
+
+    /**
+     * @brief Grow or shrink to numFrames. Views handed out before are no
+     * longer valid.
+     */
+    bool resize( size_t numFrames );
+
+    Mat frame( size_t k );
+    size_t numFrames( ) const { return numFrames_; }
+    bool isOpen( ) const { return fd_ >= 0; }
+
+    /**
+     * @brief Write the header with the final number of frames and unmap.
+     */
+    void close( );
+
+private:
+    ArrayFile( const ArrayFile& );
+    ArrayFile& operator=( const ArrayFile& );
+
+    bool map( );
+    void unmap( );
+    string shape( size_t numFrames ) const;
+    string npy_dict( size_t numFrames ) const;
+    void write_header( );
+
+    string filename_;
+    bool npy_;
+    int fd_;
+    uchar* data_;
+    size_t size_;
+    size_t numFrames_;
+    Size frameSize_;
+    int type_;
+};
+
+/**
+ * @brief True when filename is written as an ArrayFile: .npy or .raw.
+ */
+bool is_array_file( const string& filename );
+
+/**
+ * @brief The .json file which describes filename, empty if there is none
+ * (.npy has its own header).
+ */
+string array_sidecar( const string& filename );
+
+#endif   /* ----- #ifndef arrayfile_INC  ----- */
@@ -0,0 +1,318 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  batch.cpp
+ *
+ *    Description:  Stabilize many recordings concurrently in one process.
+ *
+ *        Version:  1.0
+ *        Created:  11/14/2016 04:20:51 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#include "batch.h"
+#include "framestore.h"
+#include "arrayfile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include <glob.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Memory needed to stabilize a file, in multiples of its size: the frames,
+// the corrected frames and the intermediates of the estimator.
+const double BATCH_MEMORY_FACTOR = 3.0;
+
+struct BatchItem
+{
+    BatchEntry entry;
+    double size = 0;                            /* MB */
+    string status = "pending";
+    string message;
+    double seconds = 0;
+
+    double throughput( ) const 
+    { 
+        return ( status == "done" && seconds > 0 ) ? size / seconds : 0; 
+    }
+};
+
+static double file_size_mb( const string& path )
+{
+    struct stat st;
+    if( stat( path.c_str( ), &st ) != 0 )
+        return -1;
+    return st.st_size / 1048576.0;
+}
+
+/**
+ * @brief Hidden file next to outfile, with the same extension so that it is
+ * written in the same format.
+ */
+static string partial_filename( const string& outfile )
+{
+    size_t slash = outfile.find_last_of( '/' );
+    size_t base = ( slash == string::npos ) ? 0 : slash + 1;
+    return outfile.substr( 0, base ) + ".part." + outfile.substr( base );
+}
+
+vector< BatchEntry > batch_entries( const string& spec )
+{
+    vector< BatchEntry > entries;
+    if( spec.find_first_of( "*?[" ) != string::npos )
+    {
+        glob_t g;
+        if( glob( spec.c_str( ), 0, NULL, &g ) == 0 )
+            for( size_t i = 0; i < g.gl_pathc; i++ )
+                entries.push_back( BatchEntry{ g.gl_pathv[i], "" } );
+        globfree( &g );
+        return entries;
+    }
+
+    ifstream manifest( spec );
+    if( ! manifest )
+    {
+        std::cout << "[WARN] Could not open manifest " << spec << std::endl;
+        return entries;
+    }
+
+    string line;
+    while( getline( manifest, line ) )
+    {
+        line.erase( line.find_last_not_of( " \t\r" ) + 1 );
+        if( line.empty( ) || line[0] == '#' )
+            continue;
+
+        size_t tab = line.find( '\t' );
+        if( tab == string::npos )
+            entries.push_back( BatchEntry{ line, "" } );
+        else
+            entries.push_back( BatchEntry{ line.substr( 0, tab ), line.substr( tab + 1 ) } );
+    }
+    return entries;
+}
+
+static void process( BatchItem& item, const file_body_t& body )
+{
+    string partial = partial_filename( item.entry.outfile );
+
+    // .raw output is described by a .json file, which goes along with it.
+    string partialSidecar = array_sidecar( partial );
+    string sidecar = array_sidecar( item.entry.outfile );
+
+    auto start = chrono::steady_clock::now( );
+    try
+    {
+        body( item.entry.infile, partial );
+        if( file_size_mb( partial ) < 0 )
+        {
+            item.status = "failed";
+            item.message = "no output written";
+        }
+        else if( rename( partial.c_str( ), item.entry.outfile.c_str( ) ) != 0 )
+        {
+            item.status = "failed";
+            item.message = "could not rename " + partial;
+        }
+        else if( ! sidecar.empty( ) 
+                && rename( partialSidecar.c_str( ), sidecar.c_str( ) ) != 0 )
+        {
+            item.status = "failed";
+            item.message = "could not rename " + partialSidecar;
+        }
+        else
+            item.status = "done";
+    }
+    catch( exception& e )
+    {
+        item.status = "failed";
+        item.message = e.what( );
+    }
+    item.seconds = chrono::duration< double >( chrono::steady_clock::now( ) - start ).count( );
+
+    if( item.status != "done" )
+    {
+        remove( partial.c_str( ) );
+        if( ! partialSidecar.empty( ) )
+            remove( partialSidecar.c_str( ) );
+    }
+}
+
+/**
+ * @brief A CSV field in double quotes, with quotes in it doubled, so that
+ * commas and newlines in paths and messages stay in their field.
+ */
+static string csv_quoted( const string& field )
+{
+    string quoted = "\"";
+    for( char c : field )
+    {
+        if( c == '"' )
+            quoted += '"';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+static void write_summary( const string& filename, const vector< BatchItem >& items )
+{
+    ofstream out( filename );
+    if( ! out )
+    {
+        std::cout << "[WARN] Could not write summary to " << filename << std::endl;
+        return;
+    }
+
+    out << "input,output,status,size_mb,seconds,mb_per_s,message" << endl;
+    out << fixed << setprecision( 3 );
+    for( auto& item : items )
+        out << csv_quoted( item.entry.infile ) << "," << csv_quoted( item.entry.outfile ) 
+            << "," << item.status << "," << item.size << "," << item.seconds
+            << "," << item.throughput( )
+            << "," << csv_quoted( item.message ) << endl;
+}
+
+size_t stabilize_batch( const vector< BatchEntry >& entries
+        , const BatchOptions& options
+        , const file_body_t& body
+        )
+{
+    double limit = options.memoryLimit > 0 ? options.memoryLimit : 0.75 * physical_memory_mb( );
+
+    vector< BatchItem > items( entries.size( ) );
+    for( size_t i = 0; i < entries.size( ); i++ )
+    {
+        items[i].entry = entries[i];
+        items[i].size = file_size_mb( entries[i].infile );
+        if( items[i].size < 0 )
+        {
+            items[i].size = 0;
+            items[i].status = "failed";
+            items[i].message = "input not found";
+        }
+        else if( ! options.force && file_size_mb( entries[i].outfile ) >= 0 )
+            items[i].status = "skipped";
+    }
+
+    // Largest first, see stabilize_batch( ).
+    vector< BatchItem* > pending;
+    for( auto& item : items )
+        if( item.status == "pending" )
+            pending.push_back( &item );
+    stable_sort( pending.begin( ), pending.end( )
+            , []( const BatchItem* a, const BatchItem* b ) { return a->size > b->size; }
+            );
+
+    std::cout << "[INFO] Batch of " << items.size( ) << " files, " << pending.size( )
+        << " to do, " << options.jobs << " at a time, memory limit "
+        << ( size_t ) limit << " MB." << std::endl;
+
+    mutex m;
+    condition_variable changed;
+    size_t running = 0;
+    double reserved = 0;
+    auto start = chrono::steady_clock::now( );
+
+    // Largest pending file which fits under the memory limit. Called with m
+    // locked.
+    auto next_item = [&]( ) -> BatchItem* {
+        for( size_t i = 0; i < pending.size( ); i++ )
+        {
+            BatchItem* item = pending[i];
+            if( running == 0 || reserved + BATCH_MEMORY_FACTOR * item->size <= limit )
+            {
+                pending.erase( pending.begin( ) + i );
+                return item;
+            }
+        }
+        return NULL;
+    };
+
+    auto worker = [&]( ) {
+        unique_lock< mutex > lock( m );
+        while( true )
+        {
+            BatchItem* item = NULL;
+            changed.wait( lock, [&]{ return pending.empty( ) || ( item = next_item( ) ) != NULL; } );
+            if( ! item )
+                return;
+
+            double need = BATCH_MEMORY_FACTOR * item->size;
+            if( need > limit )
+                std::cout << "[WARN] " << item->entry.infile << " needs about "
+                    << ( size_t ) need << " MB, more than the memory limit." << std::endl;
+            running += 1;
+            reserved += need;
+            lock.unlock( );
+
+            std::cout << "[INFO] Stabilizing " << item->entry.infile << std::endl;
+            process( *item, body );
+            std::cout << "[INFO] " << item->entry.infile << ": " << item->status
+                << ( item->message.empty( ) ? "" : " (" + item->message + ")" ) << std::endl;
+
+            lock.lock( );
+            running -= 1;
+            reserved -= need;
+            changed.notify_all( );
+        }
+    };
+
+    vector< thread > workers;
+    for( size_t i = 0; i < max( ( size_t ) 1, options.jobs ); i++ )
+        workers.push_back( thread( worker ) );
+    for( auto& w : workers )
+        w.join( );
+
+    double elapsed = chrono::duration< double >( chrono::steady_clock::now( ) - start ).count( );
+
+    /*-----------------------------------------------------------------------------
+     *  Summary.
+     *-----------------------------------------------------------------------------*/
+    size_t numDone = 0, numSkipped = 0, numFailed = 0;
+    double sizeDone = 0;
+    for( auto& item : items )
+    {
+        std::cout << "[INFO]   " << setw( 8 ) << left << item.status << right
+            << fixed << setprecision( 1 ) << setw( 9 ) << item.size << " MB"
+            << setw( 8 ) << item.seconds << " s"
+            << setw( 8 ) << item.throughput( ) << " MB/s  "
+            << item.entry.infile
+            << ( item.message.empty( ) ? "" : " (" + item.message + ")" ) << std::endl;
+
+        if( item.status == "done" )
+        {
+            numDone += 1;
+            sizeDone += item.size;
+        }
+        else if( item.status == "skipped" )
+            numSkipped += 1;
+        else
+            numFailed += 1;
+    }
+
+    std::cout << "[INFO] " << numDone << " done, " << numSkipped << " skipped, "
+        << numFailed << " failed. " << fixed << setprecision( 1 ) << sizeDone
+        << " MB in " << elapsed << " s (" << ( elapsed > 0 ? sizeDone / elapsed : 0 )
+        << " MB/s)." << std::endl;
+
+    if( options.summary.size( ) > 0 )
+        write_summary( options.summary, items );
+
+    return numFailed;
+}
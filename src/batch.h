@@ -0,0 +1,74 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  batch.h
+ *
+ *    Description:  Stabilize many recordings concurrently in one process.
+ *
+ *        Version:  1.0
+ *        Created:  11/14/2016 04:20:51 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#ifndef  batch_INC
+#define  batch_INC
+
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct BatchEntry
+{
+    string infile;
+    string outfile;
+};
+
+struct BatchOptions
+{
+    size_t jobs = 2;                            /* Files processed at a time. */
+    double memoryLimit = 0;                     /* MB, 0 for 3/4 of the RAM. */
+    bool force = false;                         /* Redo finished outputs. */
+    string summary;                             /* CSV file, one line per file. */
+};
+
+typedef function< void( const string&, const string& ) > file_body_t;
+
+/**
+ * @brief Inputs of a batch: a glob pattern such as '*.tif', or a
+ * manifest file with one input per line, optionally followed by a tab and its
+ * output file. Empty lines and lines starting with # are skipped. Outputs
+ * not given are left empty.
+ */
+vector< BatchEntry > batch_entries( const string& spec );
+
+/**
+ * @brief Run body( infile, outfile ) for every entry.
+ *
+ * Up to options.jobs files are processed at a time. They share the thread pool
+ * (see parallel.h) so a file in I/O leaves the cores to the others. Largest
+ * files are started first so that no worker is left idle at the end with a
+ * big file still running. A file is only started when the memory it needs
+ * (estimated from its size) fits under the limit along with the running ones;
+ * one file always runs, even if it is larger.
+ *
+ * Output is written under a temporary name and renamed when body returns, so
+ * existing outputs are complete and are skipped unless options.force is set.
+ * Status, size and throughput of every file are printed and written to
+ * options.summary.
+ *
+ * @return Number of files which failed.
+ */
+size_t stabilize_batch( const vector< BatchEntry >& entries
+        , const BatchOptions& options
+        , const file_body_t& body 
+        );
+
+#endif   /* ----- #ifndef batch_INC  ----- */
@@ -0,0 +1,324 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  checkpoint.cpp
+ *
+ *    Description:  Stabilize long recordings with periodic checkpoints so that
+ *                  an interrupted run can be resumed.
+ *
+ *        Version:  1.0
+ *        Created:  11/21/2016 10:37:04 AM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#include "checkpoint.h"
+#include "videoio.h"
+#include "metrics.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <sstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Frames read, estimated and written at a time. A multiple of
+// ESTIMATION_CHUNK so that blocks give the same transforms as a whole
+// recording, see estimate_transforms( ).
+const size_t CHECKPOINT_BLOCK = 32 * ESTIMATION_CHUNK;
+
+// At most this much work is lost when a run is interrupted.
+const double CHECKPOINT_SECONDS = 60.0;
+
+static const char CHECKPOINT_MAGIC[8] = { 'V', 'S', 'C', 'K', 'P', 'T', '0', '1' };
+
+/**
+ * @brief Options which change the corrections or the output.
+ */
+static string current_settings( )
+{
+    ostringstream s;
+    s << "estimator=" << estimator_name_ << " prefilter=" << prefilter_name_
+        << " grid=" << feature_grid_ << " features=" << features_per_cell_
+        << " redetect=" << redetect_fraction_ << " scale=" << estimation_scale_
+        << " refine=" << refine_estimate_ << " smoother=" << smoother_name_
+        << " radius=" << smoothing_radius_ << " crop=" << border_crop_
+        << " compression=" << tiff_compression_;
+    return s.str( );
+}
+
+/*-----------------------------------------------------------------------------
+ *  Checkpoint file.
+ *-----------------------------------------------------------------------------*/
+template< typename T >
+static void put( FILE* f, const T& v )
+{
+    fwrite( &v, sizeof( v ), 1, f );
+}
+
+template< typename T >
+static bool get( FILE* f, T& v )
+{
+    return fread( &v, sizeof( v ), 1, f ) == 1;
+}
+
+bool write_checkpoint( const string& filename, const Checkpoint& c )
+{
+    string tmp = filename + ".tmp";
+    FILE* f = fopen( tmp.c_str( ), "wb" );
+    if( ! f )
+    {
+        std::cout << "[WARN] Could not write checkpoint " << filename << std::endl;
+        return false;
+    }
+
+    fwrite( CHECKPOINT_MAGIC, 1, 8, f );
+    put( f, c.inputSize );
+    put( f, c.inputMtime );
+    put( f, ( uint64_t ) c.settings.size( ) );
+    fwrite( c.settings.data( ), 1, c.settings.size( ), f );
+    put( f, ( uint8_t ) c.estimated );
+    put( f, c.written );
+
+    put( f, ( uint8_t ) ( c.lastT.data != NULL ) );
+    for( int i = 0; i < 6; i++ )
+        put( f, c.lastT.data ? c.lastT.at< double >( i / 3, i % 3 ) : 0.0 );
+
+    put( f, ( uint64_t ) c.transforms.size( ) );
+    for( auto& t : c.transforms )
+    {
+        double v[3] = { t.dx, t.dy, t.da };
+        fwrite( v, sizeof( v ), 1, f );
+    }
+
+    bool ok = ( fflush( f ) == 0 ) && ( fsync( fileno( f ) ) == 0 );
+    ok = ( fclose( f ) == 0 ) && ok;
+    if( ok )
+        ok = ( rename( tmp.c_str( ), filename.c_str( ) ) == 0 );
+    if( ! ok )
+        std::cout << "[WARN] Could not write checkpoint " << filename << std::endl;
+    return ok;
+}
+
+bool read_checkpoint( const string& filename, Checkpoint& c )
+{
+    FILE* f = fopen( filename.c_str( ), "rb" );
+    if( ! f )
+        return false;
+
+    char magic[8];
+    uint64_t settingsSize = 0, n = 0;
+    uint8_t estimated = 0, hasLastT = 0;
+    bool ok = fread( magic, 1, 8, f ) == 8
+        && memcmp( magic, CHECKPOINT_MAGIC, 8 ) == 0
+        && get( f, c.inputSize ) && get( f, c.inputMtime )
+        && get( f, settingsSize ) && settingsSize < ( 1 << 20 );
+    if( ok )
+    {
+        c.settings.resize( settingsSize );
+        ok = fread( &c.settings[0], 1, settingsSize, f ) == settingsSize
+            && get( f, estimated ) && get( f, c.written ) && get( f, hasLastT );
+    }
+
+    double T[6];
+    for( int i = 0; ok && i < 6; i++ )
+        ok = get( f, T[i] );
+    ok = ok && get( f, n );
+
+    c.transforms.clear( );
+    for( uint64_t k = 0; ok && k < n; k++ )
+    {
+        double v[3];
+        ok = fread( v, sizeof( v ), 1, f ) == 1;
+        c.transforms.push_back( TransformParam( v[0], v[1], v[2] ) );
+    }
+    fclose( f );
+
+    if( ! ok )
+    {
+        std::cout << "[WARN] " << filename << " is not a valid checkpoint." << std::endl;
+        return false;
+    }
+
+    c.estimated = estimated != 0;
+    c.lastT = hasLastT ? Mat( 2, 3, CV_64F, T ).clone( ) : Mat( );
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+ *  Checkpointed stabilization.
+ *-----------------------------------------------------------------------------*/
+static bool file_identity( const string& filename, uint64_t& size, int64_t& mtime )
+{
+    struct stat st;
+    if( stat( filename.c_str( ), &st ) != 0 )
+        return false;
+    size = st.st_size;
+    mtime = st.st_mtime;
+    return true;
+}
+
+/**
+ * @brief Number of complete pages of a TIFF file, 0 if it does not exist.
+ * A page which was being written when the run was interrupted is not linked
+ * yet and does not count.
+ */
+static size_t tiff_pages( const string& filename )
+{
+    if( access( filename.c_str( ), F_OK ) != 0 )
+        return 0;
+
+    TIFF* tif = TIFFOpen( filename.c_str( ), "r" );
+    if( ! tif )
+        return 0;
+    size_t n = TIFFNumberOfDirectories( tif );
+    TIFFClose( tif );
+    return n;
+}
+
+void stabilize_checkpointed( const string& infile, const string& outfile
+        , const string& checkpointFile
+        )
+{
+    uint64_t inputSize = 0;
+    int64_t inputMtime = 0;
+    if( ! file_identity( infile, inputSize, inputMtime ) )
+    {
+        std::cout << "Could not open " << infile << std::endl;
+        return;
+    }
+
+    Checkpoint c;
+    string settings = current_settings( );
+    if( read_checkpoint( checkpointFile, c ) )
+    {
+        if( c.inputSize != inputSize || c.inputMtime != inputMtime || c.settings != settings )
+        {
+            std::cout << "[WARN] " << checkpointFile << " is of another input or"
+                << " other options. Starting over." << std::endl;
+            c = Checkpoint( );
+        }
+        else
+            std::cout << "[INFO] Resuming: " << c.transforms.size( ) << " pairs"
+                << " estimated, " << c.written << " frames written." << std::endl;
+    }
+    c.inputSize = inputSize;
+    c.inputMtime = inputMtime;
+    c.settings = settings;
+
+    auto lastSave = chrono::steady_clock::now( );
+    auto save = [&]( bool now ) {
+        auto t = chrono::steady_clock::now( );
+        if( ! now && chrono::duration< double >( t - lastSave ).count( ) < CHECKPOINT_SECONDS )
+            return;
+        write_checkpoint( checkpointFile, c );
+        lastSave = t;
+        if( verbose_flag_ )
+            std::cout << "[INFO] Checkpoint: " << c.transforms.size( ) << " pairs"
+                << " estimated, " << c.written << " frames written." << std::endl;
+    };
+
+    /*-----------------------------------------------------------------------------
+     *  Step 1, block by block. The last frame of a block is the first one of
+     *  the next block.
+     *-----------------------------------------------------------------------------*/
+    if( ! c.estimated )
+    {
+        FrameReader reader;
+        if( ! open_reader_at( reader, infile, c.transforms.size( ) ) )
+            return;
+
+        vector< Mat > block;
+        Mat frame;
+        while( true )
+        {
+            while( block.size( ) < CHECKPOINT_BLOCK + 1 && reader.read( frame ) )
+                block.push_back( frame );
+
+            estimate_transforms( block, c.transforms, c.lastT, c.transforms.size( ) );
+            if( block.size( ) < CHECKPOINT_BLOCK + 1 )
+                break;
+
+            block.erase( block.begin( ), block.end( ) - 1 );
+            save( false );
+        }
+        c.estimated = true;
+        save( true );
+    }
+
+    // Step 2 to 4 are cheap, they are done again on every run.
+    vector< TransformParam > corrections;
+    corrections_from_transforms( c.transforms, corrections );
+
+    /*-----------------------------------------------------------------------------
+     *  Step 5, block by block. The output file is the truth about how many
+     *  frames were written: pages written after the last checkpoint are kept.
+     *-----------------------------------------------------------------------------*/
+    if( c.written > 0 )
+    {
+        size_t pages = tiff_pages( outfile );
+        if( pages != c.written )
+            std::cout << "[INFO] " << outfile << " has " << pages << " complete"
+                << " frames, continuing after them." << std::endl;
+        c.written = min( pages, corrections.size( ) );
+    }
+
+    FrameWriter writer;
+    if( ! writer.open( outfile, infile, corrections.size( ), c.written ) )
+    {
+        std::cout << "[WARN] Writing " << outfile << " again." << std::endl;
+        c.written = 0;
+        if( ! writer.open( outfile, infile, corrections.size( ) ) )
+            return;
+    }
+
+    FrameReader reader;
+    if( ! open_reader_at( reader, infile, c.written ) )
+        return;
+
+    vector< Mat > block, corrected;
+    Mat frame;
+    while( c.written < corrections.size( ) )
+    {
+        block.clear( );
+        size_t n = min( CHECKPOINT_BLOCK, ( size_t ) ( corrections.size( ) - c.written ) );
+        while( block.size( ) < n && reader.read( frame ) )
+            block.push_back( frame );
+        if( block.empty( ) )
+            break;
+
+        vector< TransformParam > slice( corrections.begin( ) + c.written
+                , corrections.begin( ) + c.written + block.size( )
+                );
+        corrected.clear( );
+        apply_corrections( block, slice, corrected, c.written );
+        for( auto& f : corrected )
+            if( ! writer.write( f ) )
+                throw runtime_error( "could not write " + outfile );
+
+        c.written += corrected.size( );
+        save( false );
+    }
+    writer.close( );
+
+    if( c.written < corrections.size( ) )
+    {
+        std::cout << "[WARN] " << infile << " ended after " << c.written
+            << " frames." << std::endl;
+        save( true );
+        return;
+    }
+
+    remove( checkpointFile.c_str( ) );
+    std::cout << "[INFO] Wrote " << c.written << " corrected frames to " << outfile
+        << std::endl;
+}
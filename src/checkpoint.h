@@ -0,0 +1,75 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  checkpoint.h
+ *
+ *    Description:  Stabilize long recordings with periodic checkpoints so that
+ *                  an interrupted run can be resumed.
+ *
+ *        Version:  1.0
+ *        Created:  11/21/2016 10:37:04 AM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#ifndef  checkpoint_INC
+#define  checkpoint_INC
+
+#include "stablizer.h"
+
+/**
+ * @brief State of a checkpointed run.
+ */
+struct Checkpoint
+{
+    // Identify the input and the options which change the result. A
+    // checkpoint of another input or other options is not resumed.
+    uint64_t inputSize = 0;
+    int64_t inputMtime = 0;
+    string settings;
+
+    vector< TransformParam > transforms;        /* Step 1, so far. */
+    Mat lastT;                                  /* Last good transform. */
+    bool estimated = false;                     /* All of Step 1 done. */
+    uint64_t written = 0;                       /* Frames in the output. */
+};
+
+/**
+ * @brief Write the checkpoint to a temporary file and rename it, so that a
+ * crash while writing leaves the previous checkpoint intact.
+ *
+ * Format: the magic VSCKPT01, input size (uint64), input modification time
+ * (int64), length of the settings (uint64) and the settings, estimated
+ * (uint8), frames written (uint64), whether there is a last good transform
+ * (uint8) and its 6 doubles, the number of transforms (uint64) and three
+ * doubles per transform. All in native byte order.
+ */
+bool write_checkpoint( const string& filename, const Checkpoint& c );
+bool read_checkpoint( const string& filename, Checkpoint& c );
+
+/**
+ * @brief Stabilize infile (single pass) and write the result to outfile,
+ * saving progress to checkpointFile every CHECKPOINT_SECONDS.
+ *
+ * Frames are read, estimated and then corrected and written in blocks of
+ * CHECKPOINT_BLOCK frames, so memory does not grow with the recording. When
+ * checkpointFile exists and belongs to the same input and options, pairs
+ * which were already estimated are not estimated again and the output is
+ * appended to after the last complete page (TIFF output only). The result is
+ * the same as that of an uninterrupted run. The checkpoint is removed once
+ * the output is complete.
+ *
+ * @param infile
+ * @param outfile
+ * @param checkpointFile
+ */
+void stabilize_checkpointed( const string& infile, const string& outfile
+        , const string& checkpointFile 
+        );
+
+#endif   /* ----- #ifndef checkpoint_INC  ----- */
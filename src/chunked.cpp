@@ -0,0 +1,360 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  chunked.cpp
+ *
+ *    Description:  Estimate motion of a recording in several processes, each
+ *                  on its own range of frames.
+ *
+ *        Version:  1.0
+ *        Created:  12/06/2016 11:26:40 AM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#include "chunked.h"
+#include "videoio.h"
+#include "parallel.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+
+#include <sched.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Frames read and estimated at a time by a worker, and corrected and written
+// at a time at the end. A multiple of ESTIMATION_CHUNK, see
+// estimate_transforms( ).
+const size_t CHUNKED_BLOCK = 32 * ESTIMATION_CHUNK;
+
+static size_t round_up( size_t n, size_t multiple )
+{
+    return ( n + multiple - 1 ) / multiple * multiple;
+}
+
+bool estimate_range( const string& infile, size_t firstPair, size_t endPair
+        , vector< TransformParam >& transforms
+        )
+{
+    transforms.clear( );
+    FrameReader reader;
+    if( ! open_reader_at( reader, infile, firstPair ) )
+        return false;
+
+    // The last frame of a block is the first one of the next block. A range
+    // may start with a pair for which no transform is found.
+    Mat last_T = Mat::eye( 2, 3, CV_64F );
+    size_t numFrames = endPair - firstPair + 1;
+    size_t numRead = 0;
+    vector< Mat > block;
+    Mat frame;
+    while( true )
+    {
+        while( block.size( ) < CHUNKED_BLOCK + 1 && numRead < numFrames && reader.read( frame ) )
+        {
+            block.push_back( frame );
+            numRead += 1;
+        }
+
+        estimate_transforms( block, transforms, last_T, firstPair + transforms.size( ) );
+        if( block.size( ) < CHUNKED_BLOCK + 1 || numRead == numFrames )
+            break;
+        block.erase( block.begin( ), block.end( ) - 1 );
+    }
+    return transforms.size( ) == endPair - firstPair;
+}
+
+double stitch_chunks( const vector< size_t >& starts
+        , const vector< vector< TransformParam > >& chunks
+        , vector< TransformParam >& transforms
+        )
+{
+    // Global trajectory, after every pair.
+    vector< Trajectory > global;
+    double disagreement = 0;
+
+    for (size_t i = 0; i < chunks.size( ); i++)
+    {
+        // Trajectory of the chunk on its own.
+        vector< Trajectory > local;
+        Trajectory acc( 0, 0, 0 );
+        for( auto& t : chunks[i] )
+        {
+            acc = Trajectory( acc.x + t.dx, acc.y + t.dy, acc.a + t.da );
+            local.push_back( acc );
+        }
+
+        size_t start = starts[i];
+        size_t numOverlap = min( global.size( ) - start, local.size( ) );
+
+        Trajectory offset( 0, 0, 0 );
+        if( numOverlap > 0 )
+        {
+            for (size_t k = 0; k < numOverlap; k++)
+            {
+                offset.x += global[start + k].x - local[k].x;
+                offset.y += global[start + k].y - local[k].y;
+                offset.a += global[start + k].a - local[k].a;
+            }
+            offset = Trajectory( offset.x / numOverlap, offset.y / numOverlap
+                    , offset.a / numOverlap
+                    );
+        }
+        else if( ! global.empty( ) )
+            offset = global.back( );
+
+        // Cross-fade from the chunk before to this one across the overlap.
+        for (size_t k = 0; k < numOverlap; k++)
+        {
+            Trajectory& g = global[start + k];
+            Trajectory l( local[k].x + offset.x, local[k].y + offset.y, local[k].a + offset.a );
+            disagreement = max( disagreement, hypot( g.x - l.x, g.y - l.y ) );
+
+            double w = ( k + 1.0 ) / ( numOverlap + 1.0 );
+            g = Trajectory( ( 1 - w ) * g.x + w * l.x, ( 1 - w ) * g.y + w * l.y
+                    , ( 1 - w ) * g.a + w * l.a
+                    );
+        }
+        for (size_t k = numOverlap; k < local.size( ); k++)
+            global.push_back( Trajectory( local[k].x + offset.x, local[k].y + offset.y
+                        , local[k].a + offset.a )
+                    );
+    }
+
+    transforms.clear( );
+    Trajectory prev( 0, 0, 0 );
+    for( auto& g : global )
+    {
+        transforms.push_back( TransformParam( g.x - prev.x, g.y - prev.y, g.a - prev.a ) );
+        prev = g;
+    }
+    return disagreement;
+}
+
+/**
+ * @brief Restrict this process to its share of the CPUs it may run on, so
+ * that workers do not compete for cores and their memory stays on their NUMA
+ * node.
+ */
+static void pin_worker( size_t worker, size_t numWorkers )
+{
+#ifdef __linux__
+    cpu_set_t available;
+    if( sched_getaffinity( 0, sizeof( available ), &available ) != 0 )
+        return;
+
+    vector< int > cpus;
+    for( int c = 0; c < CPU_SETSIZE; c++ )
+        if( CPU_ISSET( c, &available ) )
+            cpus.push_back( c );
+    if( cpus.size( ) < numWorkers )
+        return;
+
+    cpu_set_t mine;
+    CPU_ZERO( &mine );
+    for( size_t j = worker * cpus.size( ) / numWorkers; j < ( worker + 1 ) * cpus.size( ) / numWorkers; j++ )
+        CPU_SET( cpus[j], &mine );
+    sched_setaffinity( 0, sizeof( mine ), &mine );
+#endif
+}
+
+/**
+ * @brief Body of a worker process: estimate the range and send the
+ * transforms to fd, as their number (uint64) and three doubles each.
+ */
+static void run_worker( const string& infile, size_t firstPair, size_t endPair, int fd )
+{
+    vector< TransformParam > transforms;
+    bool ok = false;
+    try
+    {
+        ok = estimate_range( infile, firstPair, endPair, transforms );
+    }
+    catch( exception& e )
+    {
+        std::cerr << "[WARN] " << e.what( ) << std::endl;
+    }
+
+    FILE* f = fdopen( fd, "wb" );
+    uint64_t n = transforms.size( );
+    fwrite( &n, sizeof( n ), 1, f );
+    for( auto& t : transforms )
+    {
+        double v[3] = { t.dx, t.dy, t.da };
+        fwrite( v, sizeof( v ), 1, f );
+    }
+    ok = ( fclose( f ) == 0 ) && ok;
+    _exit( ok ? 0 : 1 );
+}
+
+static bool read_worker( int fd, vector< TransformParam >& transforms )
+{
+    FILE* f = fdopen( fd, "rb" );
+    uint64_t n = 0;
+    bool ok = fread( &n, sizeof( n ), 1, f ) == 1;
+    for( uint64_t k = 0; ok && k < n; k++ )
+    {
+        double v[3];
+        ok = fread( v, sizeof( v ), 1, f ) == 1;
+        transforms.push_back( TransformParam( v[0], v[1], v[2] ) );
+    }
+    fclose( f );
+    return ok;
+}
+
+bool stabilize_chunked( const string& infile, const string& outfile
+        , size_t numWorkers, size_t overlap
+        )
+{
+    size_t numFrames = 0;
+    {
+        video_info_t vInfo;
+        FrameReader reader;
+        if( ! reader.open( infile, vInfo ) )
+            throw runtime_error( "could not open " + infile );
+        numFrames = vInfo.numFrames;
+    }
+    if( numFrames < 2 )
+    {
+        std::cout << "[WARN] Number of frames of " << infile << " is not known,"
+            << " it is stabilized in this process." << std::endl;
+        return false;
+    }
+
+    /*-----------------------------------------------------------------------------
+     *  Step 1, one range of pairs per worker. Every worker but the first also
+     *  estimates the overlap before its range.
+     *-----------------------------------------------------------------------------*/
+    size_t numPairs = numFrames - 1;
+    numWorkers = max( ( size_t ) 1, min( numWorkers, numPairs / ESTIMATION_CHUNK ) );
+    overlap = round_up( overlap, ESTIMATION_CHUNK );
+
+    vector< size_t > begins, ends, starts;
+    for (size_t i = 0; i < numWorkers; i++)
+    {
+        begins.push_back( i * numPairs / numWorkers / ESTIMATION_CHUNK * ESTIMATION_CHUNK );
+        ends.push_back( ( i + 1 ) * numPairs / numWorkers / ESTIMATION_CHUNK * ESTIMATION_CHUNK );
+        starts.push_back( begins[i] - min( begins[i], overlap ) );
+    }
+    ends.back( ) = numPairs;
+
+    size_t threadsPerWorker = max( ( size_t ) 1, get_num_threads( ) / numWorkers );
+    std::cout << "[INFO] Estimating " << numPairs << " pairs in " << numWorkers
+        << " processes of " << threadsPerWorker << " threads, overlapping by "
+        << overlap << " frames." << std::endl;
+
+    // Output buffered so far would be written again by every worker.
+    std::cout.flush( );
+    std::cerr.flush( );
+    fflush( NULL );
+
+    auto start = chrono::steady_clock::now( );
+    vector< pid_t > pids( numWorkers, -1 );
+    vector< int > fds( numWorkers, -1 );
+    for (size_t i = 0; i < numWorkers; i++)
+    {
+        int p[2];
+        if( pipe( p ) != 0 )
+            continue;
+
+        pid_t pid = fork( );
+        if( pid == 0 )
+        {
+            ::close( p[0] );
+            pin_worker( i, numWorkers );
+            set_num_threads( threadsPerWorker );
+            run_worker( infile, starts[i], ends[i], p[1] );
+        }
+
+        ::close( p[1] );
+        if( pid < 0 )
+            ::close( p[0] );
+        else
+        {
+            pids[i] = pid;
+            fds[i] = p[0];
+        }
+    }
+
+    vector< vector< TransformParam > > chunks( numWorkers );
+    for (size_t i = 0; i < numWorkers; i++)
+    {
+        bool ok = false;
+        if( pids[i] > 0 )
+        {
+            ok = read_worker( fds[i], chunks[i] );
+            int status = 0;
+            waitpid( pids[i], &status, 0 );
+            ok = ok && WIFEXITED( status ) && WEXITSTATUS( status ) == 0
+                && chunks[i].size( ) == ends[i] - starts[i];
+        }
+
+        if( ! ok )
+        {
+            std::cout << "[WARN] Worker " << i << " failed, estimating pairs "
+                << starts[i] << " to " << ends[i] << " here." << std::endl;
+            if( ! estimate_range( infile, starts[i], ends[i], chunks[i] ) )
+                throw runtime_error( "could not read frames " + to_string( starts[i] ) 
+                        + " to " + to_string( ends[i] ) + " of " + infile 
+                        );
+        }
+    }
+
+    vector< TransformParam > transforms;
+    double disagreement = stitch_chunks( starts, chunks, transforms );
+    std::cout << "[INFO] Estimated in "
+        << chrono::duration< double >( chrono::steady_clock::now( ) - start ).count( )
+        << " s. Chunks agree to " << disagreement << " px in the overlaps." << std::endl;
+
+    // Step 2 to 4.
+    vector< TransformParam > corrections;
+    corrections_from_transforms( transforms, corrections );
+
+    /*-----------------------------------------------------------------------------
+     *  Step 5, block by block.
+     *-----------------------------------------------------------------------------*/
+    FrameWriter writer;
+    if( ! writer.open( outfile, infile, corrections.size( ) ) )
+        throw runtime_error( "could not write " + outfile );
+
+    FrameReader reader;
+    if( ! open_reader_at( reader, infile, 0 ) )
+        throw runtime_error( "could not open " + infile );
+
+    vector< Mat > block, corrected;
+    Mat frame;
+    size_t numWritten = 0;
+    while( numWritten < corrections.size( ) )
+    {
+        block.clear( );
+        size_t n = min( CHUNKED_BLOCK, corrections.size( ) - numWritten );
+        while( block.size( ) < n && reader.read( frame ) )
+            block.push_back( frame );
+        if( block.empty( ) )
+            break;
+
+        vector< TransformParam > slice( corrections.begin( ) + numWritten
+                , corrections.begin( ) + numWritten + block.size( )
+                );
+        corrected.clear( );
+        apply_corrections( block, slice, corrected, numWritten );
+        for( auto& f : corrected )
+            if( ! writer.write( f ) )
+                throw runtime_error( "could not write " + outfile );
+        numWritten += corrected.size( );
+    }
+    writer.close( );
+
+    std::cout << "[INFO] Wrote " << numWritten << " corrected frames to " << outfile
+        << std::endl;
+    return true;
+}
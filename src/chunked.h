@@ -0,0 +1,86 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  chunked.h
+ *
+ *    Description:  Estimate motion of a recording in several processes, each
+ *                  on its own range of frames.
+ *
+ *        Version:  1.0
+ *        Created:  12/06/2016 11:26:40 AM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#ifndef  chunked_INC
+#define  chunked_INC
+
+#include "stablizer.h"
+
+/**
+ * @brief Transforms of the pairs [firstPair, endPair) of infile, i.e. of
+ * frames firstPair to endPair. Frames are read and estimated in blocks, so
+ * memory does not grow with the range.
+ *
+ * @return false if infile ended before endPair.
+ */
+bool estimate_range( const string& infile, size_t firstPair, size_t endPair
+        , vector< TransformParam >& transforms
+        );
+
+/**
+ * @brief Stitch the trajectories of overlapping chunks into one.
+ *
+ * Chunk i starts at pair starts[i] and its transforms are chunks[i]; it
+ * overlaps the chunk before in the pairs they both estimated. The trajectory
+ * of every chunk is offset by its mean difference from the one before over
+ * the overlap, and the two are cross-faded across the overlap.
+ *
+ * @param transforms Transforms of all pairs, consistent with the stitched
+ * trajectory.
+ *
+ * @return Largest distance between the trajectories of two chunks in an
+ * overlap, after the offset, in pixels.
+ */
+double stitch_chunks( const vector< size_t >& starts
+        , const vector< vector< TransformParam > >& chunks
+        , vector< TransformParam >& transforms
+        );
+
+/**
+ * @brief Stabilize infile (single pass) with Step 1 split across numWorkers
+ * processes, and write the result to outfile.
+ *
+ * The pairs are split into numWorkers ranges aligned to ESTIMATION_CHUNK.
+ * Every range is estimated by a fork( )ed worker which reads only its own
+ * frames, starting overlap frames before its range, with its share of the
+ * threads and pinned to its share of the CPUs (Linux). The trajectories are
+ * stitched with stitch_chunks( ), then smoothed, and the frames are corrected
+ * and written in blocks by this process. A range whose worker failed is
+ * estimated here.
+ *
+ * Ranges and overlap are multiples of ESTIMATION_CHUNK, so the chunks agree
+ * in the overlaps and the result is that of a single process unless a
+ * transform was not found near the start of a range.
+ *
+ * Must be called before anything ran on the thread pool, see fork( ).
+ * Throws runtime_error when infile can not be read or outfile written.
+ *
+ * @param infile
+ * @param outfile
+ * @param numWorkers
+ * @param overlap Frames, rounded up to a multiple of ESTIMATION_CHUNK.
+ *
+ * @return false, without writing anything, when the number of frames of
+ * infile is not known (some video containers); it can not be split then.
+ */
+bool stabilize_chunked( const string& infile, const string& outfile
+        , size_t numWorkers, size_t overlap
+        );
+
+#endif   /* ----- #ifndef chunked_INC  ----- */
@@ -0,0 +1,694 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  estimator.cpp
+ *
+ *    Description:  Motion estimators (Step 1 of the stabilizer).
+ *
+ *        Version:  1.0
+ *        Created:  10/19/2016 03:12:40 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#include "estimator.h"
+#include "stablizer.h"
+#include "metrics.h"
+
+#include <cfloat>
+
+// Minimum distance between detected corners, in pixels.
+const double FEATURE_MIN_DISTANCE = 3;
+
+// Window and number of pyramid levels (above the base) of pyramidal LK.
+const int LK_WINDOW = 21;
+const int LK_LEVELS = 3;
+
+// A tracked corner agrees with the fitted transform when it is closer than
+// this, in pixels. Only used for metrics.
+const double FEATURE_INLIER_DISTANCE = 1.0;
+
+// Full resolution refinement of ScaledEstimator: at most this many corners,
+// tracked in a window of this size. Fewer corners than REFINE_MIN_CORNERS
+// keep the coarse transform.
+const int REFINE_MAX_CORNERS = 200;
+const size_t REFINE_MIN_CORNERS = 8;
+const int REFINE_WINDOW = 11;
+
+// Phase correlation has failed when the correlation peak is lower than this.
+const double PHASE_MIN_RESPONSE = 0.01;
+
+// Rotation (in radian) below which the current frame is not de-rotated before
+// its shift is estimated.
+const double PHASE_DEROTATE_ANGLE = 1e-3;
+
+/*-----------------------------------------------------------------------------
+ *  FeatureEstimator
+ *-----------------------------------------------------------------------------*/
+void prefilter( const Mat& grey, Mat& filtered )
+{
+    if( prefilter_name_ == "gaussian" )
+        GaussianBlur( grey, filtered, Size( 5, 5 ), 1.0 );
+    else if( prefilter_name_ == "none" )
+        filtered = grey;
+    else
+        bilateralFilter( grey, filtered, 9, 50, 50 );
+}
+
+FeatureEstimator::FeatureEstimator( ) : numDetected_( 0 )
+{
+}
+
+void FeatureEstimator::reset( )
+{
+    byteView_.reset( );
+    prev_ = PreparedFrame( );
+    numDetected_ = 0;
+}
+
+void FeatureEstimator::detect( const Mat& grey, vector< Point2f >& corners ) const
+{
+    StageTimer timer( "detect" );
+    corners.clear( );
+
+    size_t nx = max( ( size_t ) 1, feature_grid_ );
+    size_t ny = nx;
+    vector< Point2f > cellCorners;
+    for (size_t i = 0; i < ny; i++) 
+    {
+        int y0 = i * grey.rows / ny;
+        int y1 = ( i + 1 ) * grey.rows / ny;
+        for (size_t j = 0; j < nx; j++) 
+        {
+            int x0 = j * grey.cols / nx;
+            int x1 = ( j + 1 ) * grey.cols / nx;
+            if( y1 <= y0 || x1 <= x0 )
+                continue;
+
+            // Quality is relative to the best corner in this cell, so that
+            // faint regions get their share of corners too.
+            goodFeaturesToTrack( grey( Rect( x0, y0, x1 - x0, y1 - y0 ) )
+                    , cellCorners, features_per_cell_, 0.01, FEATURE_MIN_DISTANCE 
+                    );
+            for( auto& p : cellCorners )
+                corners.push_back( Point2f( p.x + x0, p.y + y0 ) );
+        }
+    }
+}
+
+/**
+ * @brief Number of corners which T maps within FEATURE_INLIER_DISTANCE of
+ * where they were tracked to.
+ */
+static size_t count_inliers( const Mat& T, const vector< Point2f >& prev
+        , const vector< Point2f >& cur 
+        )
+{
+    size_t n = 0;
+    for (size_t i = 0; i < prev.size( ); i++) 
+    {
+        const Point2f& p = prev[i];
+        double x = T.at<double>( 0, 0 ) * p.x + T.at<double>( 0, 1 ) * p.y + T.at<double>( 0, 2 );
+        double y = T.at<double>( 1, 0 ) * p.x + T.at<double>( 1, 1 ) * p.y + T.at<double>( 1, 2 );
+        if( hypot( x - cur[i].x, y - cur[i].y ) < FEATURE_INLIER_DISTANCE )
+            n += 1;
+    }
+    return n;
+}
+
+void FeatureEstimator::prepare( const Mat& frame, PreparedFrame& p )
+{
+    /*-----------------------------------------------------------------------------
+     *  Function goodFeaturesToTrack works well with real video recordings
+     *  where feature sizes are large. 
+     *
+     *  To make it work with small feature sizes, we need to find as many
+     *  good feature points as possible. It probably a good idea to apply
+     *  bilinearFilter before continuing.
+     *-----------------------------------------------------------------------------*/
+    {
+        StageTimer timer( "prefilter" );
+        Mat view;
+        byteView_.convert( frame, view );
+        prefilter( view, p.grey );
+    }
+
+    // Built once here instead of twice, for both pairs, by calcOpticalFlowPyrLK.
+    StageTimer timer( "pyramid" );
+    buildOpticalFlowPyramid( p.grey, p.pyramid, Size( LK_WINDOW, LK_WINDOW ), LK_LEVELS );
+}
+
+bool FeatureEstimator::track( const Mat& frame, Mat& T )
+{
+    T = Mat( );
+
+    PreparedFrame cur;
+    prepare( frame, cur );
+
+    if( prev_.grey.data == NULL )
+    {
+        prev_ = cur;
+        detect( prev_.grey, prev_.corners );
+        numDetected_ = prev_.corners.size( );
+        record_count( "corners", numDetected_ );
+        return false;
+    }
+
+    // Carry the surviving corners over to the next pair, with the filtered
+    // frame and its pyramid.
+    T = match( prev_, cur, cur.corners );
+    prev_ = cur;
+    if( prev_.corners.size( ) < redetect_fraction_ * numDetected_ || prev_.corners.empty( ) )
+    {
+        detect( prev_.grey, prev_.corners );
+        numDetected_ = prev_.corners.size( );
+        record_count( "corners", numDetected_ );
+    }
+
+    return T.data != NULL;
+}
+
+void FeatureEstimator::set_reference( const Mat& reference )
+{
+    prepare( reference, reference_ );
+    detect( reference_.grey, reference_.corners );
+}
+
+bool FeatureEstimator::register_frame( const Mat& frame, Mat& T )
+{
+    T = Mat( );
+    if( reference_.grey.data == NULL )
+        return false;
+
+    PreparedFrame cur;
+    prepare( frame, cur );
+
+    vector< Point2f > tracked;
+    T = match( reference_, cur, tracked );
+    return T.data != NULL;
+}
+
+/**
+ * @brief Track the corners of from into to and fit a rigid transform to
+ * them.
+ *
+ * @param tracked Where the corners which stayed in the frame ended up.
+ *
+ * @return The transform, empty if none was found.
+ */
+Mat FeatureEstimator::match( const PreparedFrame& from, const PreparedFrame& to
+        , vector< Point2f >& tracked 
+        )
+{
+    // vector from prev to cur
+    vector <Point2f> curCorner;
+    vector <Point2f> prevCorner2, curCorner2;
+    vector <uchar> status;
+    vector <float> err;
+
+    const vector< Point2f >& corners = from.corners;
+    if( ! corners.empty( ) )
+    {
+        StageTimer timer( "track" );
+        calcOpticalFlowPyrLK( from.pyramid, to.pyramid, corners, curCorner, status, err
+                , Size( LK_WINDOW, LK_WINDOW ), LK_LEVELS 
+                );
+    }
+
+    // weed out bad matches and corners which left the frame.
+    for(size_t i=0; i < status.size(); i++)
+    {
+        const Point2f& p = curCorner[i];
+        if(status[i] && p.x >= 0 && p.y >= 0 && p.x < to.grey.cols && p.y < to.grey.rows)
+        {
+            prevCorner2.push_back(corners[i]);
+            curCorner2.push_back(p);
+        }
+    }
+
+#ifdef DBEUG
+    cout << "[DEBUG] good optical flow: " << prevCorner2.size() << endl;
+#endif 
+
+    // translation + rotation only
+    // false = rigid transform, no scaling/shearing
+    record_count( "tracked", prevCorner2.size( ) );
+    Mat T;
+    if( ! prevCorner2.empty( ) )
+    {
+        StageTimer timer( "estimate" );
+        T = estimateRigidTransform(prevCorner2, curCorner2, false);
+    }
+    if( recording( ) && T.data != NULL )
+        record_count( "inliers", count_inliers( T, prevCorner2, curCorner2 ) );
+
+    tracked.swap( curCorner2 );
+    return T;
+}
+
+/*-----------------------------------------------------------------------------
+ *  Phase correlation.
+ *-----------------------------------------------------------------------------*/
+
+/**
+ * @brief Offset of the vertex of the parabola through (-1, l), (0, c), (1, r).
+ */
+static double parabola_offset( double l, double c, double r )
+{
+    double denom = l - 2 * c + r;
+    if( fabs( denom ) < 1e-12 )
+        return 0.0;
+
+    double offset = 0.5 * ( l - r ) / denom;
+    return max( -0.5, min( 0.5, offset ) );
+}
+
+Point2d phase_correlate_spectra( const Mat& F1, const Mat& F2, double* response )
+{
+    // Normalized cross power spectrum: only the phase difference is kept.
+    Mat C;
+    mulSpectrums( F2, F1, C, 0, true );
+    for( int i = 0; i < C.rows; i++ )
+    {
+        Vec2f* c = C.ptr<Vec2f>( i );
+        for( int j = 0; j < C.cols; j++ )
+        {
+            float m = std::sqrt( c[j][0] * c[j][0] + c[j][1] * c[j][1] ) + FLT_EPSILON;
+            c[j][0] /= m;
+            c[j][1] /= m;
+        }
+    }
+
+    Mat corr;
+    idft( C, corr, DFT_REAL_OUTPUT | DFT_SCALE );
+
+    double maxVal;
+    Point peak;
+    minMaxLoc( corr, NULL, &maxVal, NULL, &peak );
+    if( response )
+        *response = maxVal;
+
+    // The correlation is periodic, so are the neighbours of the peak.
+    auto at = [&]( int y, int x ) -> double {
+        return corr.at<float>( ( y + corr.rows ) % corr.rows
+                , ( x + corr.cols ) % corr.cols 
+                );
+    };
+
+    double dx = peak.x + parabola_offset( at( peak.y, peak.x - 1 ), maxVal
+            , at( peak.y, peak.x + 1 ) 
+            );
+    double dy = peak.y + parabola_offset( at( peak.y - 1, peak.x ), maxVal
+            , at( peak.y + 1, peak.x ) 
+            );
+
+    if( dx > corr.cols / 2.0 )
+        dx -= corr.cols;
+    if( dy > corr.rows / 2.0 )
+        dy -= corr.rows;
+
+    return Point2d( dx, dy );
+}
+
+/**
+ * @brief Move the zero frequency to the centre. Sizes must be even.
+ */
+static void swap_quadrants( Mat& m )
+{
+    int cx = m.cols / 2;
+    int cy = m.rows / 2;
+
+    Mat q0( m, Rect( 0, 0, cx, cy ) );
+    Mat q1( m, Rect( cx, 0, cx, cy ) );
+    Mat q2( m, Rect( 0, cy, cx, cy ) );
+    Mat q3( m, Rect( cx, cy, cx, cy ) );
+
+    Mat tmp;
+    q0.copyTo( tmp );
+    q3.copyTo( q0 );
+    tmp.copyTo( q3 );
+
+    q1.copyTo( tmp );
+    q2.copyTo( q1 );
+    tmp.copyTo( q2 );
+}
+
+void windowed_spectrum( const Mat& image, const Mat& window, Mat& F )
+{
+    Mat f;
+    image.convertTo( f, CV_32F );
+    f = f - mean( f );
+    multiply( f, window, f );
+
+    Mat padded;
+    copyMakeBorder( f, padded, 0, getOptimalDFTSize( f.rows ) - f.rows
+            , 0, getOptimalDFTSize( f.cols ) - f.cols, BORDER_CONSTANT
+            );
+    dft( padded, F, DFT_COMPLEX_OUTPUT );
+}
+
+PhaseCorrelationEstimator::PhaseCorrelationEstimator( ) : 
+    havePrev_( false )
+    , haveReference_( false )
+{
+}
+
+void PhaseCorrelationEstimator::reset( )
+{
+    prev_ = Spectra( );
+    havePrev_ = false;
+}
+
+void PhaseCorrelationEstimator::compute_spectra( const Mat& frame, Spectra& s, bool withLogPolar )
+{
+    // The Hanning window keeps the frame edges from dominating the spectrum.
+    if( window_.rows != frame.rows || window_.cols != frame.cols )
+        createHanningWindow( window_, frame.size( ), CV_32F );
+    windowed_spectrum( frame, window_, s.F );
+
+    if( ! withLogPolar )
+        return;
+
+    // Magnitude does not depend on the translation and rotates with the
+    // frame. In log-polar space the rotation becomes a shift along the rows.
+    vector< Mat > planes;
+    split( s.F, planes );
+    Mat mag;
+    magnitude( planes[0], planes[1], mag );
+    mag = mag + Scalar::all( 1 );
+    log( mag, mag );
+
+    mag = mag( Rect( 0, 0, mag.cols & -2, mag.rows & -2 ) ).clone( );
+    swap_quadrants( mag );
+
+    Point2f center( mag.cols / 2.0f, mag.rows / 2.0f );
+    double M = mag.cols / std::log( min( center.x, center.y ) );
+
+    Mat lp;
+#ifdef USE_OPENCV3
+    logPolar( mag, lp, center, M, INTER_LINEAR + WARP_FILL_OUTLIERS );
+#else
+    lp.create( mag.size( ), mag.type( ) );
+    IplImage src = mag, dst = lp;
+    cvLogPolar( &src, &dst, cvPoint2D32f( center.x, center.y ), M, CV_INTER_LINEAR + CV_WARP_FILL_OUTLIERS );
+#endif
+
+    dft( lp, s.logPolarF, DFT_COMPLEX_OUTPUT );
+}
+
+bool PhaseCorrelationEstimator::track( const Mat& frame, Mat& T )
+{
+    T = Mat( );
+
+    Spectra cur;
+    {
+        StageTimer timer( "prefilter" );
+        compute_spectra( frame, cur, true );
+    }
+
+    bool found = havePrev_ && estimate( prev_, cur, frame, T );
+    prev_ = cur;
+    havePrev_ = true;
+    return found;
+}
+
+void PhaseCorrelationEstimator::set_reference( const Mat& reference )
+{
+    compute_spectra( reference, reference_, true );
+    haveReference_ = true;
+}
+
+bool PhaseCorrelationEstimator::register_frame( const Mat& frame, Mat& T )
+{
+    T = Mat( );
+    if( ! haveReference_ )
+        return false;
+
+    Spectra cur;
+    {
+        StageTimer timer( "prefilter" );
+        compute_spectra( frame, cur, true );
+    }
+    return estimate( reference_, cur, frame, T );
+}
+
+/**
+ * @brief Transform from the frame with spectra from to frame, whose spectra
+ * are to.
+ */
+bool PhaseCorrelationEstimator::estimate( const Spectra& from, const Spectra& to
+        , const Mat& frame, Mat& T 
+        )
+{
+    StageTimer timer( "estimate" );
+    bool found = false;
+    if( from.F.rows == to.F.rows && from.F.cols == to.F.cols )
+    {
+        // Rotation. Rows of the log-polar image span 2 pi but the magnitude
+        // spectrum is symmetric, so the rotation is only known up to pi.
+        double rResponse = 0;
+        Point2d r = phase_correlate_spectra( from.logPolarF, to.logPolarF, &rResponse );
+        double da = r.y * 2 * CV_PI / to.logPolarF.rows;
+        while( da > CV_PI / 2 )
+            da -= CV_PI;
+        while( da <= -CV_PI / 2 )
+            da += CV_PI;
+        if( rResponse < PHASE_MIN_RESPONSE )
+            da = 0.0;
+
+        double c = cos( da );
+        double s = sin( da );
+        Point2f center( frame.cols / 2.0f, frame.rows / 2.0f );
+
+        // Translation. Reuse the spectra when the rotation is negligible,
+        // otherwise de-rotate the current frame about its centre first.
+        double tResponse = 0;
+        Point2d d;
+        if( fabs( da ) < PHASE_DEROTATE_ANGLE )
+            d = phase_correlate_spectra( from.F, to.F, &tResponse );
+        else
+        {
+            Mat R = getRotationMatrix2D( center, da * 180 / CV_PI, 1.0 );
+            Mat derotated;
+            warpAffine( frame, derotated, R, frame.size( ), INTER_LINEAR, BORDER_REPLICATE );
+
+            Spectra s2;
+            compute_spectra( derotated, s2, false );
+            Point2d d2 = phase_correlate_spectra( from.F, s2.F, &tResponse );
+            d = Point2d( c * d2.x - s * d2.y, s * d2.x + c * d2.y );
+        }
+
+        record_count( "response", tResponse );
+        if( tResponse >= PHASE_MIN_RESPONSE )
+        {
+            // The rotation is about the centre: q = R ( p - center ) + center + d
+            T = Mat( 2, 3, CV_64F );
+            T.at<double>( 0, 0 ) = c;
+            T.at<double>( 0, 1 ) = -s;
+            T.at<double>( 1, 0 ) = s;
+            T.at<double>( 1, 1 ) = c;
+            T.at<double>( 0, 2 ) = d.x + center.x - ( c * center.x - s * center.y );
+            T.at<double>( 1, 2 ) = d.y + center.y - ( s * center.x + c * center.y );
+            found = true;
+        }
+    }
+    return found;
+}
+
+/*-----------------------------------------------------------------------------
+ *  ScaledEstimator
+ *-----------------------------------------------------------------------------*/
+ScaledEstimator::ScaledEstimator( unique_ptr< MotionEstimator > inner
+        , int scale, bool refine 
+        ) :
+    inner_( move( inner ) )
+    , scale_( scale )
+    , refine_( refine )
+{
+}
+
+void ScaledEstimator::reset( )
+{
+    inner_->reset( );
+    byteView_.reset( );
+    prevFull_ = Mat( );
+    prevSmall_ = Mat( );
+}
+
+void ScaledEstimator::bin( const Mat& frame, Mat& small ) const
+{
+    if( scale_ > 1 )
+    {
+        StageTimer timer( "prefilter" );
+        resize( frame, small, Size( ), 1.0 / scale_, 1.0 / scale_, INTER_AREA );
+    }
+    else
+        small = frame;
+}
+
+void ScaledEstimator::scale_up( const Mat& Ts, Mat& T ) const
+{
+    // Pixel p of the binned frame is centred at s ( p + 0.5 ) - 0.5 of
+    // the full one: T = R p + s t - ( s - 1 ) / 2 ( R - I ) ( 1, 1 ).
+    double s = scale_;
+    double h = ( s - 1 ) / 2;
+    T = Ts.clone( );
+    T.at<double>( 0, 2 ) = s * Ts.at<double>( 0, 2 ) 
+        - h * ( Ts.at<double>( 0, 0 ) - 1 + Ts.at<double>( 0, 1 ) );
+    T.at<double>( 1, 2 ) = s * Ts.at<double>( 1, 2 ) 
+        - h * ( Ts.at<double>( 1, 0 ) + Ts.at<double>( 1, 1 ) - 1 );
+}
+
+bool ScaledEstimator::track( const Mat& frame, Mat& T )
+{
+    T = Mat( );
+
+    Mat small;
+    bin( frame, small );
+
+    Mat Ts;
+    if( inner_->track( small, Ts ) )
+        scale_up( Ts, T );
+
+    if( refine_ )
+    {
+        Mat curFull, curSmall;
+        byteView_.convert( frame, curFull );
+        if( scale_ > 1 )
+            resize( curFull, curSmall, Size( ), 1.0 / scale_, 1.0 / scale_, INTER_AREA );
+        else
+            curSmall = curFull;
+
+        if( T.data != NULL && prevFull_.data != NULL && prevFull_.size( ) == curFull.size( ) )
+            refine( prevFull_, prevSmall_, curFull, T );
+
+        prevFull_ = curFull;
+        prevSmall_ = curSmall;
+    }
+
+    return T.data != NULL;
+}
+
+void ScaledEstimator::set_reference( const Mat& reference )
+{
+    Mat small;
+    bin( reference, small );
+    inner_->set_reference( small );
+
+    if( refine_ )
+    {
+        byteView_.convert( reference, referenceFull_ );
+        if( scale_ > 1 )
+            resize( referenceFull_, referenceSmall_, Size( ), 1.0 / scale_, 1.0 / scale_
+                    , INTER_AREA 
+                    );
+        else
+            referenceSmall_ = referenceFull_;
+    }
+}
+
+bool ScaledEstimator::register_frame( const Mat& frame, Mat& T )
+{
+    T = Mat( );
+
+    Mat small;
+    bin( frame, small );
+
+    Mat Ts;
+    if( ! inner_->register_frame( small, Ts ) )
+        return false;
+    scale_up( Ts, T );
+
+    if( refine_ && referenceFull_.data != NULL )
+    {
+        Mat curFull;
+        byteView_.convert( frame, curFull );
+        if( referenceFull_.size( ) == curFull.size( ) )
+            refine( referenceFull_, referenceSmall_, curFull, T );
+    }
+    return true;
+}
+
+/**
+ * @brief Refine T from the frame fromFull (binned: fromSmall) to curFull.
+ */
+void ScaledEstimator::refine( const Mat& fromFull, const Mat& fromSmall
+        , const Mat& curFull, Mat& T 
+        )
+{
+    StageTimer timer( "refine" );
+
+    // Corners are found at estimation resolution, where it is cheap.
+    vector< Point2f > prevPts, curPts;
+    goodFeaturesToTrack( fromSmall, prevPts, REFINE_MAX_CORNERS, 0.01
+            , FEATURE_MIN_DISTANCE 
+            );
+    if( prevPts.size( ) < REFINE_MIN_CORNERS )
+        return;
+
+    double s = scale_;
+    for( auto& p : prevPts )
+    {
+        p = Point2f( s * ( p.x + 0.5 ) - 0.5, s * ( p.y + 0.5 ) - 0.5 );
+        curPts.push_back( Point2f( 
+                    T.at<double>( 0, 0 ) * p.x + T.at<double>( 0, 1 ) * p.y + T.at<double>( 0, 2 )
+                    , T.at<double>( 1, 0 ) * p.x + T.at<double>( 1, 1 ) * p.y + T.at<double>( 1, 2 ) 
+                    ) );
+    }
+
+    // The coarse transform is good to about a binned pixel, so a small window
+    // on two pyramid levels (maxLevel 1) is enough.
+    vector< uchar > status;
+    vector< float > err;
+    calcOpticalFlowPyrLK( fromFull, curFull, prevPts, curPts, status, err
+            , Size( REFINE_WINDOW, REFINE_WINDOW ), 1
+            , TermCriteria( TermCriteria::COUNT + TermCriteria::EPS, 20, 0.01 )
+            , OPTFLOW_USE_INITIAL_FLOW 
+            );
+
+    vector< Point2f > prevGood, curGood;
+    for (size_t i = 0; i < status.size( ); i++) 
+    {
+        const Point2f& p = curPts[i];
+        if( status[i] && p.x >= 0 && p.y >= 0 && p.x < curFull.cols && p.y < curFull.rows )
+        {
+            prevGood.push_back( prevPts[i] );
+            curGood.push_back( p );
+        }
+    }
+    if( prevGood.size( ) < REFINE_MIN_CORNERS )
+        return;
+
+    Mat Tr = estimateRigidTransform( prevGood, curGood, false );
+    if( Tr.data != NULL )
+        T = Tr;
+}
+
+/*-----------------------------------------------------------------------------
+ *  Factory
+ *-----------------------------------------------------------------------------*/
+unique_ptr< MotionEstimator > make_estimator( const string& name )
+{
+    unique_ptr< MotionEstimator > estimator;
+    if( name == "features" )
+        estimator.reset( new FeatureEstimator( ) );
+    else if( name == "phase" )
+        estimator.reset( new PhaseCorrelationEstimator( ) );
+    return estimator;
+}
+
+unique_ptr< MotionEstimator > make_estimator( )
+{
+    unique_ptr< MotionEstimator > estimator = make_estimator( estimator_name_ );
+    if( estimator && ( estimation_scale_ > 1 || refine_estimate_ ) )
+        estimator.reset( new ScaledEstimator( move( estimator )
+                    , max( 1, estimation_scale_ ), refine_estimate_ 
+                    ) 
+                );
+    return estimator;
+}
@@ -0,0 +1,230 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  estimator.h
+ *
+ *    Description:  Motion estimators (Step 1 of the stabilizer).
+ *
+ *        Version:  1.0
+ *        Created:  10/19/2016 03:12:40 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#ifndef  estimator_INC
+#define  estimator_INC
+
+#include <memory>
+#include "globals.h"
+#include "videoio.h"
+
+/**
+ * @brief Estimates the rigid transform between consecutive frames.
+ *
+ * Frames are fed in order with track( ). An estimator keeps whatever it
+ * computed for the previous frame, so the work done on a frame is shared by
+ * both pairs it is part of. Estimators are not thread safe; use one per
+ * thread.
+ *
+ * Frames can also be registered to a fixed reference with set_reference( )
+ * and register_frame( ). Whatever is computed from the reference is kept, so
+ * it is done once for all frames.
+ */
+class MotionEstimator
+{
+public:
+    virtual ~MotionEstimator( ) {}
+
+    /**
+     * @brief Forget the previous frame.
+     */
+    virtual void reset( ) = 0;
+
+    /**
+     * @brief Feed the next frame.
+     *
+     * @param frame
+     * @param T 2x3 rigid transform from the previous frame to this one. Empty
+     * if there is no previous frame or no transform was found.
+     *
+     * @return false if no transform was found.
+     */
+    virtual bool track( const Mat& frame, Mat& T ) = 0;
+
+    /**
+     * @brief Set the reference of register_frame( ). Independent of the
+     * frames fed with track( ).
+     */
+    virtual void set_reference( const Mat& reference ) = 0;
+
+    /**
+     * @brief Rigid transform from the reference to frame. Unlike track( ),
+     * frame does not replace the reference.
+     *
+     * @return false if no transform was found or no reference is set.
+     */
+    virtual bool register_frame( const Mat& frame, Mat& T ) = 0;
+};
+
+/**
+ * @brief Denoise an 8 bit frame before corners are detected and tracked, with
+ * the filter selected by prefilter_name_: bilateral (edge preserving, the
+ * slowest), gaussian (separable) or none.
+ */
+void prefilter( const Mat& grey, Mat& filtered );
+
+/**
+ * @brief Tracks corners with pyramidal Lucas-Kanade and fits a rigid
+ * transform to them.
+ *
+ * Corners are detected on a grid of feature_grid_ x feature_grid_ cells with
+ * at most features_per_cell_ corners per cell, so the number of tracked
+ * corners does not grow with the frame size. Corners which were tracked into
+ * the current frame are tracked further into the next one; corners are only
+ * detected again when less than redetect_fraction_ of them survive. Frames
+ * which are not 8 bit are tracked on a ByteView of them. Each frame is
+ * prefiltered and its LK pyramid built only once.
+ */
+class FeatureEstimator : public MotionEstimator
+{
+public:
+    FeatureEstimator( );
+
+    void reset( );
+    bool track( const Mat& frame, Mat& T );
+    void set_reference( const Mat& reference );
+    bool register_frame( const Mat& frame, Mat& T );
+
+private:
+    /**
+     * @brief Everything computed from one frame, shared by the two pairs
+     * the frame is part of.
+     */
+    struct PreparedFrame
+    {
+        Mat grey;                               /* Prefiltered, 8 bit. */
+        vector< Mat > pyramid;                  /* LK pyramid of grey. */
+        vector< Point2f > corners;              /* To track into the next frame. */
+    };
+
+    void prepare( const Mat& frame, PreparedFrame& p );
+    void detect( const Mat& grey, vector< Point2f >& corners ) const;
+    Mat match( const PreparedFrame& from, const PreparedFrame& to
+            , vector< Point2f >& tracked 
+            );
+
+    ByteView byteView_;
+    PreparedFrame prev_;
+    size_t numDetected_;
+    PreparedFrame reference_;
+};
+
+/**
+ * @brief Phase correlation on the Fourier transform of the frames.
+ *
+ * The rotation is the shift along the angle axis between the log-polar
+ * magnitude spectra, the translation is the shift between the frames. Both
+ * are refined to sub pixel accuracy. The forward transforms of each frame are
+ * computed once. Only when the rotation is not negligible, the current frame
+ * is de-rotated and transformed once more for this pair.
+ */
+class PhaseCorrelationEstimator : public MotionEstimator
+{
+public:
+    PhaseCorrelationEstimator( );
+
+    void reset( );
+    bool track( const Mat& frame, Mat& T );
+    void set_reference( const Mat& reference );
+    bool register_frame( const Mat& frame, Mat& T );
+
+private:
+    struct Spectra 
+    {
+        Mat F;                                  /* Spectrum of windowed frame. */
+        Mat logPolarF;                          /* Spectrum of log-polar magnitude. */
+    };
+
+    void compute_spectra( const Mat& frame, Spectra& s, bool withLogPolar );
+    bool estimate( const Spectra& from, const Spectra& to, const Mat& frame, Mat& T );
+
+    Mat window_;
+    Spectra prev_;
+    bool havePrev_;
+    Spectra reference_;
+    bool haveReference_;
+};
+
+/**
+ * @brief Runs another estimator on frames binned by scale and scales its
+ * transform back up. Optionally the transform is refined at full resolution:
+ * corners of the previous frame are tracked with LK in a small window around
+ * where the coarse transform puts them, and a rigid transform is fitted again.
+ */
+class ScaledEstimator : public MotionEstimator
+{
+public:
+    ScaledEstimator( unique_ptr< MotionEstimator > inner, int scale, bool refine );
+
+    void reset( );
+    bool track( const Mat& frame, Mat& T );
+    void set_reference( const Mat& reference );
+    bool register_frame( const Mat& frame, Mat& T );
+
+private:
+    void bin( const Mat& frame, Mat& small ) const;
+    void scale_up( const Mat& Ts, Mat& T ) const;
+    void refine( const Mat& fromFull, const Mat& fromSmall, const Mat& curFull, Mat& T );
+
+    unique_ptr< MotionEstimator > inner_;
+    int scale_;
+    bool refine_;
+
+    // Previous frame and reference, 8 bit, at full and at estimation
+    // resolution.
+    ByteView byteView_;
+    Mat prevFull_;
+    Mat prevSmall_;
+    Mat referenceFull_;
+    Mat referenceSmall_;
+};
+
+/**
+ * @brief Spectrum of image after removing its mean and multiplying by window
+ * (same size as image). Zero padded to a size the FFT is fast for.
+ *
+ * @param image
+ * @param window Usually a Hanning window, see createHanningWindow( ).
+ * @param F Complex spectrum (CV_32FC2, full).
+ */
+void windowed_spectrum( const Mat& image, const Mat& window, Mat& F );
+
+/**
+ * @brief Shift of the image with spectrum F2 relative to the one with
+ * spectrum F1, by phase correlation with sub pixel peak refinement.
+ *
+ * @param F1 Complex spectrum (CV_32FC2, full).
+ * @param F2 Complex spectrum of the same size.
+ * @param response Height of the normalized correlation peak (0 to 1).
+ */
+Point2d phase_correlate_spectra( const Mat& F1, const Mat& F2, double* response = NULL );
+
+/**
+ * @brief Create the estimator by name: features or phase.
+ *
+ * @return NULL if the name is unknown.
+ */
+unique_ptr< MotionEstimator > make_estimator( const string& name );
+
+/**
+ * @brief Create the estimator selected on the command line, wrapped in a
+ * ScaledEstimator when estimation_scale_ > 1 or refine_estimate_ is set.
+ */
+unique_ptr< MotionEstimator > make_estimator( );
+
+#endif   /* ----- #ifndef estimator_INC  ----- */
@@ -0,0 +1,207 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  framestore.cpp
+ *
+ *    Description:  Frames of a recording in one contiguous block of memory,
+ *                  spilled to a scratch file beyond a memory budget.
+ *
+ *        Version:  1.0
+ *        Created:  12/09/2016 04:51:13 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#include "framestore.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Bytes of all FrameStores which are in memory, i.e. not spilled.
+static atomic< size_t > bytes_in_memory_( 0 );
+
+double physical_memory_mb( )
+{
+    long pages = sysconf( _SC_PHYS_PAGES );
+    long pageSize = sysconf( _SC_PAGE_SIZE );
+    if( pages <= 0 || pageSize <= 0 )
+        return 0;
+    return ( double ) pages * pageSize / 1048576.0;
+}
+
+static size_t budget_bytes( )
+{
+    double mb = frame_memory_budget_ > 0 ? frame_memory_budget_ : 0.75 * physical_memory_mb( );
+    return mb > 0 ? ( size_t ) ( mb * 1048576.0 ) : SIZE_MAX;
+}
+
+/**
+ * @brief Take bytes from the budget if they fit.
+ */
+static bool reserve_memory( size_t bytes )
+{
+    size_t budget = budget_bytes( );
+    size_t used = bytes_in_memory_.load( );
+    while( used <= budget && bytes <= budget - used )
+        if( bytes_in_memory_.compare_exchange_weak( used, used + bytes ) )
+            return true;
+    return false;
+}
+
+/**
+ * @brief Create a scratch file which is deleted as soon as it is closed.
+ *
+ * @return The file descriptor, -1 on failure.
+ */
+static int open_scratch_file( )
+{
+    string dir = scratch_dir_;
+    if( dir.empty( ) )
+        dir = getenv( "TMPDIR" ) ? getenv( "TMPDIR" ) : "/tmp";
+
+    string path = dir + "/videostab.XXXXXX";
+    vector< char > name( path.begin( ), path.end( ) );
+    name.push_back( '\0' );
+
+    int fd = mkstemp( &name[0] );
+    if( fd < 0 )
+    {
+        std::cout << "[WARN] Could not create a scratch file in " << dir << std::endl;
+        return -1;
+    }
+    unlink( &name[0] );
+    return fd;
+}
+
+/*-----------------------------------------------------------------------------
+ *  FrameStore
+ *-----------------------------------------------------------------------------*/
+FrameStore::FrameStore( ) :
+    data_( NULL )
+    , bytes_( 0 )
+    , fd_( -1 )
+    , numFrames_( 0 )
+    , type_( CV_8UC1 )
+{
+}
+
+FrameStore::~FrameStore( )
+{
+    release( );
+}
+
+bool FrameStore::allocate( size_t numFrames, Size frameSize, int type )
+{
+    release( );
+    frameSize_ = frameSize;
+    type_ = type;
+
+    // An empty mapping is not allowed.
+    size_t bytes = max( ( size_t ) 1, numFrames * frameSize.area( ) * CV_ELEM_SIZE( type ) );
+    if( ! reserve_memory( bytes ) )
+    {
+        fd_ = open_scratch_file( );
+        if( fd_ < 0 )
+            return false;
+        std::cout << "[INFO] " << bytes / 1048576 << " MB of frames are over the"
+            << " memory budget, they are kept in a scratch file." << std::endl;
+    }
+
+    if( ! map( bytes ) )
+    {
+        release( );
+        return false;
+    }
+    numFrames_ = numFrames;
+    return true;
+}
+
+bool FrameStore::map( size_t bytes )
+{
+    void* addr = MAP_FAILED;
+    if( fd_ < 0 )
+        addr = mmap( NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    else if( ftruncate( fd_, bytes ) == 0 )
+        addr = mmap( NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0 );
+
+    if( addr == MAP_FAILED )
+    {
+        std::cout << "[WARN] Could not allocate " << bytes / 1048576 << " MB for frames."
+            << std::endl;
+        if( fd_ < 0 )
+            bytes_in_memory_ -= bytes;
+        return false;
+    }
+    data_ = ( uchar* ) addr;
+    bytes_ = bytes;
+    return true;
+}
+
+bool FrameStore::resize( size_t numFrames )
+{
+    if( data_ == NULL )
+        return false;
+
+    size_t bytes = max( ( size_t ) 1, numFrames * frameSize_.area( ) * CV_ELEM_SIZE( type_ ) );
+    if( fd_ >= 0 && ftruncate( fd_, max( bytes, bytes_ ) ) != 0 )
+        return false;
+
+    void* addr = mremap( data_, bytes_, bytes, MREMAP_MAYMOVE );
+    if( addr == MAP_FAILED )
+    {
+        std::cout << "[WARN] Could not resize frames to " << bytes / 1048576 << " MB."
+            << std::endl;
+        return false;
+    }
+    if( fd_ >= 0 && bytes < bytes_ && ftruncate( fd_, bytes ) != 0 )
+        std::cout << "[WARN] Could not shrink the scratch file." << std::endl;
+
+    // A store in memory stays there, even beyond the budget.
+    if( fd_ < 0 )
+        bytes_in_memory_ += bytes - bytes_;
+    data_ = ( uchar* ) addr;
+    bytes_ = bytes;
+    numFrames_ = numFrames;
+    return true;
+}
+
+void FrameStore::release( )
+{
+    if( data_ )
+    {
+        munmap( data_, bytes_ );
+        if( fd_ < 0 )
+            bytes_in_memory_ -= bytes_;
+    }
+    if( fd_ >= 0 )
+        ::close( fd_ );
+
+    data_ = NULL;
+    bytes_ = 0;
+    fd_ = -1;
+    numFrames_ = 0;
+}
+
+Mat FrameStore::frame( size_t k ) const
+{
+    size_t frameBytes = frameSize_.area( ) * CV_ELEM_SIZE( type_ );
+    return Mat( frameSize_, type_, data_ + k * frameBytes );
+}
+
+vector< Mat > FrameStore::frames( ) const
+{
+    vector< Mat > views;
+    for( size_t k = 0; k < numFrames_; k++ )
+        views.push_back( frame( k ) );
+    return views;
+}
@@ -0,0 +1,84 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  framestore.h
+ *
+ *    Description:  Frames of a recording in one contiguous block of memory,
+ *                  spilled to a scratch file beyond a memory budget.
+ *
+ *        Version:  1.0
+ *        Created:  12/09/2016 04:51:13 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#ifndef  framestore_INC
+#define  framestore_INC
+
+#include "globals.h"
+
+/**
+ * @brief Frames of one size and type stored one after the other in a single
+ * page aligned block, instead of one heap allocation per frame.
+ *
+ * frame( k ) is a view of frame k inside the block. Reading, warping or
+ * copying into it writes the store directly, and threads may fill different
+ * frames without locking. Views must not be used after the store is
+ * released, resized or destroyed.
+ *
+ * The block is anonymous memory as long as all FrameStores together fit in
+ * frame_memory_budget_. Beyond that, the block is a scratch file in
+ * scratch_dir_, mapped into memory and deleted right away, so the kernel
+ * writes frames to local disk and reads them back as they are used.
+ */
+class FrameStore
+{
+public:
+    FrameStore( );
+    ~FrameStore( );
+
+    bool allocate( size_t numFrames, Size frameSize, int type );
+
+    /**
+     * @brief Grow or shrink to numFrames, keeping the frames which remain.
+     * Views handed out before are no longer valid.
+     */
+    bool resize( size_t numFrames );
+
+    void release( );
+
+    Mat frame( size_t k ) const;
+
+    /**
+     * @brief Views of all frames.
+     */
+    vector< Mat > frames( ) const;
+
+    size_t size( ) const { return numFrames_; }
+    bool spilled( ) const { return fd_ >= 0; }
+
+private:
+    FrameStore( const FrameStore& );
+    FrameStore& operator=( const FrameStore& );
+
+    bool map( size_t bytes );
+
+    uchar* data_;
+    size_t bytes_;
+    int fd_;                                    /* Scratch file, when spilled. */
+    size_t numFrames_;
+    Size frameSize_;
+    int type_;
+};
+
+/**
+ * @brief Installed memory in MB, 0 if unknown.
+ */
+double physical_memory_mb( );
+
+#endif   /* ----- #ifndef framestore_INC  ----- */
@@ -21,3 +21,25 @@
 
 // When true, enable verbose output everywhere.
 bool verbose_flag_ = false;
+
+// See globals.h
+string estimator_name_ = "features";
+string prefilter_name_ = "bilateral";
+size_t feature_grid_ = 8;
+size_t features_per_cell_ = 32;
+double redetect_fraction_ = 0.5;
+int estimation_scale_ = 1;
+bool refine_estimate_ = false;
+string smoother_name_ = "box";
+size_t smoothing_radius_ = 50;
+string registration_mode_ = "pairwise";
+size_t template_frames_ = 20;
+size_t template_iterations_ = 3;
+int patch_size_ = 128;
+int patch_overlap_ = 32;
+double max_patch_shift_ = 10.0;
+int border_crop_ = 10;
+bool tiff_index_cache_ = false;
+string tiff_compression_ = "none";
+double frame_memory_budget_ = 0;
+string scratch_dir_ = "";
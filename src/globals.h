@@ -30,4 +30,61 @@ using namespace cv;
 
 extern bool verbose_flag_;
 
+// Motion estimator: features (corner tracking) or phase (phase correlation).
+extern string estimator_name_;
+
+// Denoising before corners are detected: bilateral, gaussian or none.
+extern string prefilter_name_;
+
+// Corner detection of the features estimator: the frame is divided into a grid
+// of feature_grid_ x feature_grid_ cells with at most features_per_cell_
+// corners each. Corners are detected again when less than redetect_fraction_
+// of them are still tracked.
+extern size_t feature_grid_;
+extern size_t features_per_cell_;
+extern double redetect_fraction_;
+
+// Trajectory smoother (box, gaussian or kalman) and its radius in frames. The
+// larger the radius the more stable the video, but less reactive to sudden
+// panning.
+extern string smoother_name_;
+extern size_t smoothing_radius_;
+
+// Motion is estimated on frames binned by estimation_scale_ (1, 2, 4, ...) and
+// refined at full resolution when refine_estimate_ is set.
+extern int estimation_scale_;
+extern bool refine_estimate_;
+
+// Registration of the frames: pairwise (each frame to the previous one, then
+// smoothed) or template (each frame to a template). The first template is the
+// mean of the first template_frames_ frames; it is refined from the corrected
+// frames template_iterations_ - 1 times.
+extern string registration_mode_;
+extern size_t template_frames_;
+extern size_t template_iterations_;
+
+// Piecewise rigid correction: size and overlap of the patches and the largest
+// shift of a patch, all in pixels.
+extern int patch_size_;
+extern int patch_overlap_;
+extern double max_patch_shift_;
+
+// In pixels. Crops the border to reduce the black borders from stabilisation
+// being too noticeable.
+extern int border_crop_;
+
+// Keep the index of the pages of a TIFF file next to it (filename.ifdx) so
+// that the file is not walked again the next time it is opened. Off by
+// default, data directories are often shared or read-only.
+extern bool tiff_index_cache_;
+
+// Compression of TIFF output: none, lzw, deflate or zstd.
+extern string tiff_compression_;
+
+// Frames held in memory by all FrameStores together, in MB (0 for 3/4 of the
+// RAM). Frames beyond it are kept in a scratch file in scratch_dir_ ($TMPDIR
+// or /tmp when empty).
+extern double frame_memory_budget_;
+extern string scratch_dir_;
+
 #endif   /* ----- #ifndef globals_INC  ----- */
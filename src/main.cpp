@@ -22,10 +22,26 @@
 #include <opencv2/opencv.hpp>
 #include <iostream>
 #include <cassert>
+#include <climits>
 #include <cmath>
+#include <cstdio>
 #include <fstream>
+#include <set>
+#include <stdexcept>
 #include "videoio.h"
 #include "stablizer.h"
+#include "parallel.h"
+#include "piecewise.h"
+#include "registration.h"
+#include "pipeline.h"
+#include "online.h"
+#include "batch.h"
+#include "checkpoint.h"
+#include "chunked.h"
+#include "arrayfile.h"
+#include "framestore.h"
+#include "metrics.h"
+#include "transforms.h"
 #include "tclap/CmdLine.h"
 
 #include "easylogging++.h"
@@ -38,6 +54,277 @@ INITIALIZE_EASYLOGGINGPP
 using namespace std;
 using namespace cv;
 
+/**
+ * @brief Stabilize infile frame by frame and write the result to outfile.
+ * Memory is bounded by the smoothing window and not by the recording length.
+ *
+ * @param infile
+ * @param outfile
+ */
+void stabilize_stream( const string& infile, const string& outfile )
+{
+    video_info_t vInfo;
+    FrameReader reader;
+    if( ! reader.open( infile, vInfo ) )
+        return;
+
+    FrameWriter writer;
+    if( ! writer.open( outfile, infile, vInfo.numFrames ) )
+        return;
+
+    FrameWriter combinedWriter;
+    if( verbose_flag_ )
+        combinedWriter.open( "__combined.avi", infile );
+
+    StreamStabilizer stabilizer;
+    Mat frame, corrected, original;
+    bool done = false;
+    while( ! done )
+    {
+        if( reader.read( frame ) )
+            stabilizer.push( frame );
+        else
+        {
+            stabilizer.finish( );
+            done = true;
+        }
+
+        while( stabilizer.pop( corrected, &original ) )
+        {
+            if( ! writer.write( corrected ) )
+                throw runtime_error( "could not write " + outfile );
+            if( verbose_flag_ )
+            {
+                Mat combined;
+                hconcat( original, corrected, combined );
+                combinedWriter.write( combined );
+            }
+        }
+    }
+
+    std::cout << "[INFO] Wrote " << writer.numFrames( ) << " corrected frames to "
+        << outfile << std::endl;
+}
+
+/**
+ * @brief Where the per-frame corrections come from and where they go.
+ */
+struct SidecarOptions
+{
+    string file;                                /* Transforms file (-t). */
+    bool estimateOnly = false;                  /* Only write file. */
+    bool applyOnly = false;                     /* Read file instead of estimating. */
+    vector< string > applyTo;                   /* Other stacks to correct. */
+
+    bool used( ) const { return file.size( ) > 0 || applyTo.size( ) > 0; }
+};
+
+/**
+ * @brief Default output file of infile.
+ */
+static string corrected_filename( const string& infile )
+{
+    string::size_type pAt = infile.find_last_of('.');       
+    string ext = infile.substr( pAt+1 );
+    return infile + "_corrected." + ext;
+}
+
+/**
+ * @brief Apply corrections to the frames of infile and write them to outfile.
+ * Frames beyond the last correction are dropped.
+ */
+static void apply_to_file( const string& infile, const string& outfile
+        , const vector< TransformParam >& corrections, Size frameSize
+        )
+{
+    video_info_t vInfo;
+    FrameStore store;
+    vector< Mat > frames; 
+    read_frames( infile, store, frames, vInfo );
+    if( frames.empty( ) )
+        return;
+
+    if( frames[0].size( ) != frameSize )
+        std::cout << "[WARN] Frames of " << infile << " are not of the size the"
+            << " transforms were estimated on." << std::endl;
+    if( frames.size( ) < corrections.size( ) )
+        std::cout << "[WARN] " << infile << " has only " << frames.size( ) 
+            << " frames." << std::endl;
+
+    vector< TransformParam > c( corrections.begin( )
+            , corrections.begin( ) + min( corrections.size( ), frames.size( ) ) 
+            );
+    FrameStore correctedStore;
+    vector< Mat > corrected;
+    if( correctedStore.allocate( c.size( ), frames[0].size( ), frames[0].type( ) ) )
+    {
+        corrected = correctedStore.frames( );
+        apply_corrections_into( frames, c, corrected );
+    }
+    else
+        apply_corrections( frames, c, corrected );
+    write_frames( outfile, corrected, infile );
+}
+
+/**
+ * @brief Read all frames of infile, stabilize them in numPasses passes and
+ * write the result to outfile.
+ *
+ * When sidecar is used, the corrections of all passes are composed (as with
+ * composePasses) so that they can be written to or read from a file, and
+ * applied to other stacks as well. Piecewise correction is only done on
+ * infile. With registration_mode_ template, the corrections come from
+ * estimate_template_corrections( ) instead of numPasses passes.
+ *
+ * @param infile
+ * @param outfile
+ * @param numPasses
+ * @param composePasses Warp once at the end, see stabilize_multipass( ).
+ * @param piecewise Also correct local deformation, see correct_piecewise( ).
+ * @param sidecar
+ */
+void stabilize_file( const string& infile, const string& outfile
+        , size_t numPasses, bool composePasses, bool piecewise 
+        , const SidecarOptions& sidecar
+        )
+{
+    // Frames are views of FrameStores (or of the mapped output), see
+    // FrameStore.
+    video_info_t vInfo;
+    FrameStore store;
+    vector< Mat > frames; 
+    read_frames( infile, store, frames, vInfo );
+    if( frames.empty( ) )
+        return;
+
+    /*-----------------------------------------------------------------------------
+     *  Some time multiple passes are neccessary to correct the data.
+     *-----------------------------------------------------------------------------*/
+    // Corrections are composed when a single warp at the end is enough, see
+    // stabilize_multipass( ). .npy and .raw output is then mapped and the
+    // frames are warped straight into it.
+    ArrayFile array;
+    FrameStore correctedStore;
+    FrameStore passStores[2];
+    bool templateMode = ( registration_mode_ == "template" );
+    bool composed = sidecar.used( ) || templateMode || composePasses || numPasses == 1;
+    bool inPlace = is_array_file( outfile ) && ! piecewise && composed;
+
+    vector< Mat > stablizedFrames;
+    if( composed )
+    {
+        vector< TransformParam > corrections;
+        Size frameSize = frames[0].size( );
+        if( sidecar.applyOnly )
+        {
+            if( ! read_transforms( sidecar.file, corrections, frameSize ) )
+                return;
+            if( frameSize != frames[0].size( ) )
+                std::cout << "[WARN] Frames of " << infile << " are not of the size"
+                    << " the transforms were estimated on." << std::endl;
+        }
+        else
+        {
+            if( templateMode )
+                estimate_template_corrections( frames, corrections );
+            else
+                estimate_multipass_corrections( frames, numPasses, corrections );
+            if( sidecar.file.size( ) > 0 )
+                write_transforms( sidecar.file, corrections, frames[0].size( ) );
+        }
+
+        if( sidecar.estimateOnly )
+            return;
+
+        for( auto& other : sidecar.applyTo )
+            apply_to_file( other, corrected_filename( other ), corrections, frameSize );
+
+        corrections.resize( min( corrections.size( ), frames.size( ) ) );
+        Size size = frames[0].size( );
+        if( inPlace && array.create( outfile, corrections.size( ), size, frames[0].type( ) ) )
+        {
+            for( size_t k = 0; k < corrections.size( ); k++ )
+                stablizedFrames.push_back( array.frame( k ) );
+        }
+        else if( correctedStore.allocate( corrections.size( ), size, frames[0].type( ) ) )
+            stablizedFrames = correctedStore.frames( );
+
+        if( stablizedFrames.size( ) == corrections.size( ) )
+            apply_corrections_into( frames, corrections, stablizedFrames );
+        else
+            apply_corrections( frames, corrections, stablizedFrames );
+    }
+    else
+    {
+        // Every pass warps the frames of the pass before. Two stores take
+        // turns, the one of the pass before the last is reused.
+        vector< Mat > passFrames = frames;
+        for (size_t i = 0; i < numPasses  ; i++) 
+        {
+            std::cout << "[INFO] Running pass " << i + 1 <<  " out of " << numPasses 
+                << std::endl;
+            vector< TransformParam > corrections;
+            estimate_corrections( passFrames, corrections );
+
+            stablizedFrames.clear( );
+            FrameStore& passStore = passStores[i % 2];
+            if( passStore.allocate( corrections.size( ), frames[0].size( ), frames[0].type( ) ) )
+            {
+                stablizedFrames = passStore.frames( );
+                apply_corrections_into( passFrames, corrections, stablizedFrames );
+            }
+            else
+                apply_corrections( passFrames, corrections, stablizedFrames );
+            passFrames = stablizedFrames;
+        }
+    }
+
+    if( piecewise )
+    {
+        vector< Mat > corrected;
+        correct_piecewise( stablizedFrames, corrected );
+        stablizedFrames.swap( corrected );
+    }
+
+    std::cout << "Corrected frames " << stablizedFrames.size() << std::endl;
+
+    /*-----------------------------------------------------------------------------
+     * Write corrected video to output file. Use the format, fps and codec
+     * similar to input file. 
+     * 
+     * FIXME: Currently output is only gray-scale.
+     *-----------------------------------------------------------------------------*/
+    if( ! array.isOpen( ) )
+        write_frames( outfile, stablizedFrames, infile);
+
+    if( verbose_flag_ )
+    {
+        /*-----------------------------------------------------------------------------
+         *  Optional:
+         *
+         *  Write corrected video and non-corrected video to combined, one
+         *  frame at a time.
+         *-----------------------------------------------------------------------------*/
+        string combinedVideofileName = "__combined.avi";
+        FrameWriter combinedWriter;
+        combinedWriter.open( combinedVideofileName, infile );
+        for (size_t i = 0; i < stablizedFrames.size( ); i++) 
+        {
+            Mat combined;
+            hconcat( frames[i], stablizedFrames[i], combined );
+            combinedWriter.write( combined );
+        }
+        combinedWriter.close( );
+    }
+
+    if( array.isOpen( ) )
+    {
+        array.close( );
+        std::cout << "[INFO] Wrote frames to " << outfile << std::endl;
+    }
+
+}
+
 int main(int argc, char **argv)
 {
     /*-----------------------------------------------------------------------------
@@ -46,6 +333,21 @@ int main(int argc, char **argv)
     string infile;
     string outfile;
     size_t numPasses = 1;
+    bool stream = false;
+    bool pipeline = false;
+    bool online = false;
+    size_t latency = 0;
+    OnlineSource onlineSource;
+    string batchSpec;
+    string checkpointFile;
+    size_t numWorkers = 1;
+    size_t chunkOverlap = 0;
+    BatchOptions batch;
+    bool composePasses = false;
+    bool piecewise = false;
+    string metricsFile;
+    SidecarOptions sidecar;
+    string traceFile;
 
     /*-----------------------------------------------------------------------------
      *  Configure logger.
@@ -62,10 +364,18 @@ int main(int argc, char **argv)
                 ,"input" ,"Input file (tif or avi)"
                 ,true ,"" ,"file path"
                 );
-        cmd.add( inputArg );
+
+        TCLAP::ValueArg<std::string> batchArg("b"
+                ,"batch" ,"Stabilize many files in one run: a glob such as"
+                " 'data/*.tif' (quoted), or a manifest with one input per line,"
+                " optionally followed by a tab and the output file."
+                ,true ,"" ,"glob or manifest"
+                );
+        cmd.xorAdd( inputArg, batchArg );
 
         TCLAP::ValueArg<std::string> outputArg("o"
-                , "output" , "path to save corrected file (tif or avi)"
+                , "output" , "path to save corrected file (tif or avi). With"
+                " --batch, the directory to save corrected files in."
                 , false ,"" ,"file path"
                 );
         cmd.add( outputArg );
@@ -80,14 +390,436 @@ int main(int argc, char **argv)
                 );
         cmd.add( numpassArg );
 
+        TCLAP::ValueArg<size_t> threadsArg ("j"
+                , "threads" 
+                , "Number of threads used to estimate motion (default 0, one"
+                " per core)."
+                , false , 0 , "non-negative integer"
+                );
+        cmd.add( threadsArg );
+
+        vector< string > estimatorNames = { "features", "phase" };
+        TCLAP::ValuesConstraint< string > estimatorConstraint( estimatorNames );
+        TCLAP::ValueArg<string> estimatorArg ("e", "estimator" 
+                , "Motion estimator (default features). features: track corners"
+                " with optical flow, phase: FFT phase correlation, faster and"
+                " more robust on low-texture recordings."
+                , false , "features" , &estimatorConstraint
+                );
+        cmd.add( estimatorArg );
+
+        TCLAP::ValueArg<size_t> gridArg ("", "grid" 
+                , "Corners are detected on a grid of N x N cells (default 8)."
+                , false , 8 , "positive integer"
+                );
+        cmd.add( gridArg );
+
+        TCLAP::ValueArg<size_t> cellFeaturesArg ("", "features-per-cell" 
+                , "Maximum number of corners detected per grid cell (default 32)."
+                , false , 32 , "positive integer"
+                );
+        cmd.add( cellFeaturesArg );
+
+        TCLAP::ValueArg<double> redetectArg ("", "redetect" 
+                , "Detect corners again when less than this fraction of them"
+                " is still tracked (default 0.5)."
+                , false , 0.5 , "fraction"
+                );
+        cmd.add( redetectArg );
+
+        vector< string > prefilterNames = { "bilateral", "gaussian", "none" };
+        TCLAP::ValuesConstraint< string > prefilterConstraint( prefilterNames );
+        TCLAP::ValueArg<string> prefilterArg ("", "prefilter" 
+                , "Denoising before corners are tracked (default bilateral)."
+                " gaussian is several times faster, none skips it."
+                , false , "bilateral" , &prefilterConstraint
+                );
+        cmd.add( prefilterArg );
+
+        TCLAP::ValueArg<int> scaleArg ("", "estimation-scale" 
+                , "Estimate motion on frames binned by this factor, e.g. 2 or"
+                " 4 (default 1). Much faster on large frames when the drift is"
+                " a slow global shift."
+                , false , 1 , "positive integer"
+                );
+        cmd.add( scaleArg );
+
+        TCLAP::SwitchArg refineArg("", "refine"
+                , "Refine the motion estimated with --estimation-scale at full"
+                " resolution, tracking corners in a small window."
+                , cmd, false);
+
+        vector< string > smootherNames = { "box", "gaussian", "kalman" };
+        TCLAP::ValuesConstraint< string > smootherConstraint( smootherNames );
+        TCLAP::ValueArg<string> smootherArg ("", "smoother" 
+                , "Trajectory smoother (default box). box: moving average,"
+                " gaussian: Gaussian weighted average, kalman: causal Kalman"
+                " filter."
+                , false , "box" , &smootherConstraint
+                );
+        cmd.add( smootherArg );
+
+        TCLAP::ValueArg<size_t> radiusArg ("r"
+                , "smoothing-radius" 
+                , "Smoothing radius in frames (default 50). The larger the more"
+                " stable the video, but less reactive to sudden panning."
+                , false , 50 , "non-negative integer"
+                );
+        cmd.add( radiusArg );
+
+        vector< string > registrationNames = { "pairwise", "template" };
+        TCLAP::ValuesConstraint< string > registrationConstraint( registrationNames );
+        TCLAP::ValueArg<string> registrationArg ("", "registration" 
+                , "How frames are registered (default pairwise). pairwise:"
+                " each frame to the previous one, then the trajectory is"
+                " smoothed. template: each frame to a template which is refined"
+                " from the corrected frames; no drift, for recordings of a"
+                " still sample. -n and -r are not used."
+                , false , "pairwise" , &registrationConstraint
+                );
+        cmd.add( registrationArg );
+
+        TCLAP::ValueArg<size_t> templateFramesArg ("", "template-frames" 
+                , "The first template is the mean of this many frames"
+                " (default 20)."
+                , false , 20 , "positive integer"
+                );
+        cmd.add( templateFramesArg );
+
+        TCLAP::ValueArg<size_t> templateIterationsArg ("", "template-iterations" 
+                , "Register the frames this many times at most, every time to"
+                " the mean of the frames corrected the time before (default 3)."
+                , false , 3 , "positive integer"
+                );
+        cmd.add( templateIterationsArg );
+
+        TCLAP::ValueArg<int> cropArg (""
+                , "border-crop" 
+                , "Pixels cropped from the left and right border (default 10)"
+                " to hide the black borders left by stabilization. The top and"
+                " bottom border are cropped in proportion."
+                , false , 10 , "non-negative integer"
+                );
+        cmd.add( cropArg );
+
+        TCLAP::SwitchArg piecewiseArg("p", "piecewise"
+                , "After rigid stabilization, correct local deformation by"
+                " estimating a shift per patch (piecewise rigid)."
+                , cmd, false);
+
+        TCLAP::ValueArg<int> patchSizeArg ("", "patch-size" 
+                , "Patch size in pixels for --piecewise (default 128)."
+                , false , 128 , "positive integer"
+                );
+        cmd.add( patchSizeArg );
+
+        TCLAP::ValueArg<int> patchOverlapArg ("", "patch-overlap" 
+                , "Overlap between patches in pixels for --piecewise (default 32)."
+                , false , 32 , "non-negative integer"
+                );
+        cmd.add( patchOverlapArg );
+
+        TCLAP::ValueArg<double> maxShiftArg ("", "max-shift" 
+                , "Largest shift of a patch in pixels for --piecewise (default 10)."
+                , false , 10.0 , "pixels"
+                );
+        cmd.add( maxShiftArg );
+
         TCLAP::SwitchArg verbose("v", "verbose", "Make output verbose", cmd, false);
 
+        TCLAP::SwitchArg composeArg("c", "compose-passes"
+                , "Later passes only re-estimate motion. Corrections are"
+                " accumulated and every frame is warped once at the end, which"
+                " is faster and sharper than re-warping in every pass."
+                , cmd, false);
+
+        TCLAP::SwitchArg streamArg("s", "stream"
+                , "Read, stabilize and write frames one at a time. Memory use is"
+                " bounded by the smoothing window instead of the recording"
+                " length. Only one pass is performed."
+                , cmd, false);
+
+        TCLAP::SwitchArg pipelineArg("", "pipeline"
+                , "Stream mode with reading, stabilization and writing running"
+                " concurrently on separate threads. Implies -s."
+                , cmd, false);
+
+        TCLAP::SwitchArg onlineArg("", "online"
+                , "Stabilize frames as they are acquired. -i is a directory"
+                " watched for new images, or a pipe (- for stdin) of raw"
+                " frames of --frame-size and --bit-depth. Per-frame latency is"
+                " reported at the end."
+                , cmd, false);
+
+        TCLAP::ValueArg<size_t> latencyArg ("", "latency" 
+                , "Frames the smoother may wait for in --online mode (default"
+                " 0, causal). Larger is smoother but delays every frame."
+                , false , 0 , "non-negative integer"
+                );
+        cmd.add( latencyArg );
+
+        TCLAP::ValueArg<std::string> frameSizeArg("", "frame-size"
+                , "Width and height of raw frames read with --online, e.g."
+                " 512x512."
+                , false ,"" ,"WxH"
+                );
+        cmd.add( frameSizeArg );
+
+        vector< int > depthValues = { 8, 16, 32 };
+        TCLAP::ValuesConstraint< int > depthConstraint( depthValues );
+        TCLAP::ValueArg<int> depthArg ("", "bit-depth" 
+                , "Bits per pixel of raw frames read with --online (default"
+                " 16). 32 is float."
+                , false , 16 , &depthConstraint
+                );
+        cmd.add( depthArg );
+
+        TCLAP::ValueArg<std::string> checkpointArg("", "checkpoint"
+                , "Save progress to this file every minute and resume from it"
+                " when it exists, e.g. after a crash. Frames are processed in"
+                " blocks with bounded memory; one pass only."
+                , false ,"" ,"file path"
+                );
+        cmd.add( checkpointArg );
+
+        TCLAP::ValueArg<size_t> workersArg ("", "workers" 
+                , "Estimate motion in this many processes, each on its own"
+                " range of frames and pinned to its share of the CPUs (default"
+                " 1). For the largest recordings; one pass only."
+                , false , 1 , "positive integer"
+                );
+        cmd.add( workersArg );
+
+        TCLAP::ValueArg<size_t> chunkOverlapArg ("", "chunk-overlap" 
+                , "Frames estimated by both of two neighbouring --workers, to"
+                " stitch their trajectories (default 32)."
+                , false , 32 , "non-negative integer"
+                );
+        cmd.add( chunkOverlapArg );
+
+        TCLAP::ValueArg<double> memoryBudgetArg ("", "memory-budget" 
+                , "Keep at most this many MB of frames in memory (default 0,"
+                " 3/4 of the RAM). Frames beyond it are kept in a scratch file"
+                " on local disk."
+                , false , 0 , "MB"
+                );
+        cmd.add( memoryBudgetArg );
+
+        TCLAP::ValueArg<std::string> scratchDirArg("", "scratch-dir"
+                , "Directory of the scratch files of --memory-budget (default"
+                " $TMPDIR or /tmp). Preferably on a local SSD."
+                , false ,"" ,"directory"
+                );
+        cmd.add( scratchDirArg );
+
+        TCLAP::ValueArg<size_t> batchJobsArg ("", "batch-jobs" 
+                , "Files stabilized at a time with --batch (default 2). They"
+                " share the -j threads."
+                , false , 2 , "positive integer"
+                );
+        cmd.add( batchJobsArg );
+
+        TCLAP::ValueArg<double> memoryLimitArg ("", "memory-limit" 
+                , "With --batch, only start a file when the memory of all"
+                " running files stays under this many MB (default 0, 3/4 of"
+                " the RAM)."
+                , false , 0 , "MB"
+                );
+        cmd.add( memoryLimitArg );
+
+        TCLAP::SwitchArg forceArg("", "force"
+                , "With --batch, also stabilize files whose output exists."
+                , cmd, false);
+
+        TCLAP::ValueArg<std::string> summaryArg("", "summary"
+                , "With --batch, write status, size and throughput of every"
+                " file to this CSV file."
+                , false ,"" ,"file path"
+                );
+        cmd.add( summaryArg );
+
+        vector< string > compressionNames = { "none", "lzw", "deflate", "zstd" };
+        TCLAP::ValuesConstraint< string > compressionConstraint( compressionNames );
+        TCLAP::ValueArg<string> compressionArg ("", "compression" 
+                , "Compression of TIFF output (default none): lzw, deflate or"
+                " zstd."
+                , false , "none" , &compressionConstraint
+                );
+        cmd.add( compressionArg );
+
+        TCLAP::ValueArg<std::string> transformsArg("t", "transforms"
+                , "Write the correction of every frame to this file (.csv for"
+                " text, binary otherwise), or read them with --apply-only."
+                , false ,"" ,"file path"
+                );
+        cmd.add( transformsArg );
+
+        TCLAP::SwitchArg estimateOnlyArg("", "estimate-only"
+                , "Only estimate motion and write it to the -t file. No"
+                " output stack is written."
+                , cmd, false);
+
+        TCLAP::SwitchArg applyOnlyArg("", "apply-only"
+                , "Do not estimate motion, apply the corrections read from the"
+                " -t file."
+                , cmd, false);
+
+        TCLAP::MultiArg<std::string> applyToArg("a", "apply-to"
+                , "Apply the same corrections to this stack as well, e.g. a"
+                " dim functional channel. Written to FILE_corrected. Repeat"
+                " for more stacks."
+                , false ,"file path"
+                );
+        cmd.add( applyToArg );
+
+        TCLAP::ValueArg<std::string> metricsArg("", "metrics"
+                , "Write stage timings, per-frame counters (corners, inliers),"
+                " fallbacks to the last good transform and peak memory to this"
+                " JSON file."
+                , false ,"" ,"file path"
+                );
+        cmd.add( metricsArg );
+
+        TCLAP::ValueArg<std::string> traceArg("", "trace"
+                , "Write every stage of every frame to this file in Chrome"
+                " trace format (chrome://tracing)."
+                , false ,"" ,"file path"
+                );
+        cmd.add( traceArg );
+
+        TCLAP::SwitchArg indexCacheArg("", "index-cache"
+                , "Store the page index of TIFF files next to them"
+                " (filename.ifdx), so they open faster the next time."
+                , cmd, false);
+
         cmd.parse( argc, argv );
 
         infile = inputArg.getValue();
         outfile = outputArg.getValue( );
         numPasses = numpassArg.getValue( );
         verbose_flag_ = verbose.getValue( );
+        set_num_threads( threadsArg.getValue( ) );
+        estimator_name_ = estimatorArg.getValue( );
+        feature_grid_ = gridArg.getValue( );
+        features_per_cell_ = cellFeaturesArg.getValue( );
+        redetect_fraction_ = redetectArg.getValue( );
+
+        // 0 (or a negative number, which wraps around) would be no limit at
+        // all in goodFeaturesToTrack( ).
+        if( features_per_cell_ == 0 || features_per_cell_ > ( size_t ) INT_MAX )
+        {
+            std::cerr << "error: --features-per-cell must be a positive integer" << std::endl;
+            return 1;
+        }
+        if( redetect_fraction_ < 0 || redetect_fraction_ > 1 )
+        {
+            std::cerr << "error: --redetect must be between 0 and 1" << std::endl;
+            return 1;
+        }
+        prefilter_name_ = prefilterArg.getValue( );
+        estimation_scale_ = max( 1, scaleArg.getValue( ) );
+        refine_estimate_ = refineArg.getValue( );
+        smoother_name_ = smootherArg.getValue( );
+        smoothing_radius_ = radiusArg.getValue( );
+        border_crop_ = cropArg.getValue( );
+        if( border_crop_ < 0 )
+        {
+            std::cerr << "error: --border-crop must not be negative" << std::endl;
+            return 1;
+        }
+        registration_mode_ = registrationArg.getValue( );
+        template_frames_ = templateFramesArg.getValue( );
+        template_iterations_ = templateIterationsArg.getValue( );
+        piecewise = piecewiseArg.getValue( );
+        patch_size_ = patchSizeArg.getValue( );
+        patch_overlap_ = patchOverlapArg.getValue( );
+        max_patch_shift_ = maxShiftArg.getValue( );
+        if( patch_size_ <= 0 || patch_overlap_ < 0 || patch_overlap_ >= patch_size_ )
+        {
+            std::cerr << "error: --patch-size must be positive and larger than"
+                << " --patch-overlap (>= 0)" << std::endl;
+            return 1;
+        }
+        tiff_index_cache_ = indexCacheArg.getValue( );
+        tiff_compression_ = compressionArg.getValue( );
+        frame_memory_budget_ = memoryBudgetArg.getValue( );
+        scratch_dir_ = scratchDirArg.getValue( );
+        sidecar.file = transformsArg.getValue( );
+        sidecar.estimateOnly = estimateOnlyArg.getValue( );
+        sidecar.applyOnly = applyOnlyArg.getValue( );
+        sidecar.applyTo = applyToArg.getValue( );
+        if( ( sidecar.estimateOnly || sidecar.applyOnly ) && sidecar.file.empty( ) )
+        {
+            std::cerr << "error: --estimate-only and --apply-only need -t" << std::endl;
+            return 1;
+        }
+        metricsFile = metricsArg.getValue( );
+        traceFile = traceArg.getValue( );
+        enable_recording( metricsFile.size( ) > 0 || traceFile.size( ) > 0 );
+        batchSpec = batchArg.getValue( );
+        batch.jobs = max( ( size_t ) 1, batchJobsArg.getValue( ) );
+        batch.memoryLimit = memoryLimitArg.getValue( );
+        batch.force = forceArg.getValue( );
+        batch.summary = summaryArg.getValue( );
+        if( batchSpec.size( ) > 0 && ( sidecar.used( ) || verbose_flag_ ) )
+        {
+            std::cout << "[WARN] Transforms and the combined video (-v) are"
+                << " not written with --batch." << std::endl;
+            sidecar = SidecarOptions( );
+            verbose_flag_ = false;
+        }
+        online = onlineArg.getValue( );
+        checkpointFile = checkpointArg.getValue( );
+        if( checkpointFile.size( ) > 0 && batchSpec.size( ) > 0 )
+        {
+            std::cout << "[WARN] --checkpoint is ignored with --batch." << std::endl;
+            checkpointFile = "";
+        }
+        latency = latencyArg.getValue( );
+        numWorkers = max( ( size_t ) 1, workersArg.getValue( ) );
+        chunkOverlap = chunkOverlapArg.getValue( );
+        if( numWorkers > 1 && batchSpec.size( ) > 0 )
+        {
+            std::cout << "[WARN] --workers is ignored with --batch." << std::endl;
+            numWorkers = 1;
+        }
+        onlineSource.path = infile;
+        int w = 0, h = 0;
+        if( sscanf( frameSizeArg.getValue( ).c_str( ), "%dx%d", &w, &h ) == 2 )
+            onlineSource.frameSize = Size( w, h );
+        onlineSource.type = ( depthArg.getValue( ) == 8 ) ? CV_8UC1 
+            : ( depthArg.getValue( ) == 16 ) ? CV_16UC1 : CV_32FC1;
+        pipeline = pipelineArg.getValue( );
+        stream = streamArg.getValue( ) || pipeline;
+        if( stream && sidecar.used( ) )
+            std::cout << "[WARN] Transforms are not read or written in stream mode." 
+                << std::endl;
+        if( stream && piecewise )
+            std::cout << "[WARN] Piecewise correction is not done in stream mode." 
+                << std::endl;
+        if( checkpointFile.size( ) > 0 && ( stream || piecewise || sidecar.used( )
+                    || ( numpassArg.isSet( ) && numPasses > 1 ) ) )
+            std::cout << "[WARN] --checkpoint does a single pass, -s, -p, -n and"
+                << " transforms are ignored." << std::endl;
+        if( online && ( stream || piecewise || sidecar.used( ) ) )
+            std::cout << "[WARN] --online does a single causal pass, -s, -p and"
+                << " transforms are ignored." << std::endl;
+        if( numWorkers > 1 && ( stream || online || checkpointFile.size( ) > 0 ) )
+            std::cout << "[WARN] --workers is not used with -s, --online or"
+                << " --checkpoint." << std::endl;
+        else if( numWorkers > 1 && ( piecewise || sidecar.used( )
+                    || registration_mode_ == "template" 
+                    || ( numpassArg.isSet( ) && numPasses > 1 ) ) )
+            std::cout << "[WARN] --workers does a single pairwise pass, -p, -n,"
+                << " --registration and transforms are ignored." << std::endl;
+        if( registration_mode_ == "template" 
+                && ( stream || online || checkpointFile.size( ) > 0 ) )
+            std::cout << "[WARN] --registration template needs all frames, it"
+                << " is not done with -s, --online or --checkpoint." << std::endl;
+        composePasses = composeArg.getValue( );
+        if( stream && numpassArg.isSet( ) && numPasses > 1 )
+            std::cout << "[WARN] Only one pass is performed in stream mode." 
+                << std::endl;
 
     } 
     catch (TCLAP::ArgException &e)
@@ -95,71 +827,84 @@ int main(int argc, char **argv)
         std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl; 
     }
 
+    auto stabilize_one = [&]( const string& in, const string& out ) {
+        if( checkpointFile.size( ) > 0 )
+            stabilize_checkpointed( in, out, checkpointFile );
+        else if( pipeline )
+            stabilize_pipelined( in, out );
+        else if( stream )
+            stabilize_stream( in, out );
+        else if( numWorkers > 1 && stabilize_chunked( in, out, numWorkers, chunkOverlap ) )
+            return;
+        else
+            stabilize_file( in, out, numPasses, composePasses, piecewise, sidecar );
+    };
+
+    if( batchSpec.size( ) > 0 )
+    {
+        /*-----------------------------------------------------------------------------
+         *  Outputs which are not in the manifest go next to the input, or in
+         *  the -o directory. Outputs of earlier runs matched by the glob are
+         *  not inputs.
+         *-----------------------------------------------------------------------------*/
+        vector< BatchEntry > entries = batch_entries( batchSpec );
+        set< string > outputs;
+        for( auto& e : entries )
+        {
+            if( e.outfile.empty( ) )
+            {
+                e.outfile = corrected_filename( e.infile );
+                if( outfile.size( ) > 0 )
+                    e.outfile = outfile + "/" + e.outfile.substr( e.outfile.find_last_of( '/' ) + 1 );
+            }
+            outputs.insert( e.outfile );
+        }
+        entries.erase( remove_if( entries.begin( ), entries.end( )
+                    , [&]( const BatchEntry& e ) { return outputs.count( e.infile ) > 0; } )
+                , entries.end( )
+                );
+
+        size_t numFailed = stabilize_batch( entries, batch, stabilize_one );
+
+        if( metricsFile.size( ) > 0 )
+            write_metrics( metricsFile );
+        if( traceFile.size( ) > 0 )
+            write_trace( traceFile );
+        return numFailed > 0 ? 1 : 0;
+    }
+
     /*-----------------------------------------------------------------------------
      *  All right, command line options are parsed. Make sure when output file
      *  name is not set we set a default output file name.
      *-----------------------------------------------------------------------------*/
 
-    string::size_type pAt = infile.find_last_of('.');       
-    string ext = infile.substr( pAt+1 );
+    if( outfile.size() < 1 && online )
+        outfile = ( infile == "-" ? "stdin" 
+                : infile.substr( 0, infile.find_last_not_of( '/' ) + 1 ) 
+                ) + "_corrected.tif";
     if( outfile.size() < 1 )
-        outfile = infile + "_corrected." + ext;
+        outfile = corrected_filename( infile );
 
     std::cout << "[DEBUG] In file " << infile  << std::endl;
     std::cout << "[DEBUG] Out file " << outfile << std::endl;
 
-    video_info_t vInfo;
-    vector< Mat > frames; 
-    read_frames( infile, frames, vInfo );
-
-    /*-----------------------------------------------------------------------------
-     *  Some time multiple passes are neccessary to correct the data.
-     *-----------------------------------------------------------------------------*/
-    auto initFrames = frames;
-    vector< Mat > stablizedFrames;
-    for (size_t i = 0; i < numPasses  ; i++) 
+    try
     {
-        stablizedFrames.clear( );
-        assert( stablizedFrames.size() == 0 );
-        std::cout << "[INFO] Running pass " << i + 1 <<  " out of " << numPasses 
-            << std::endl;
-        stabilize( initFrames, stablizedFrames );
-        initFrames = stablizedFrames;
-        //stablizedFrames.clear( );
-        //assert( initFrames.size() > 0 );
+        if( online )
+            stabilize_online( onlineSource, outfile, latency );
+        else
+            stabilize_one( infile, outfile );
     }
-
-
-
-    std::cout << "Corrected frames " << stablizedFrames.size() << std::endl;
-
-    /*-----------------------------------------------------------------------------
-     * Write corrected video to output file. Use the format, fps and codec
-     * similar to input file. 
-     * 
-     * FIXME: Currently output is only gray-scale.
-     *-----------------------------------------------------------------------------*/
-    write_frames( outfile, stablizedFrames, infile);
-
-    if( verbose_flag_ )
+    catch( exception& e )
     {
-        /*-----------------------------------------------------------------------------
-         *  Optional:
-         *
-         *  Write corrected video and non-corrected video to combined.
-         *-----------------------------------------------------------------------------*/
-        vector< Mat > combinedFrames;
-        string combinedVideofileName = "__combined.avi";
-        for (size_t i = 0; i < stablizedFrames.size( ); i++) 
-        {
-            Mat combined;
-            hconcat( frames[i], stablizedFrames[i], combined );
-            combinedFrames.push_back( combined );
-            //imshow( "combined", combined );
-            //waitKey( 100 );
-        }
-        write_frames( combinedVideofileName, combinedFrames, infile );
+        std::cout << "[WARN] Failed, " << e.what( ) << std::endl;
+        return 1;
     }
 
+    if( metricsFile.size( ) > 0 )
+        write_metrics( metricsFile );
+    if( traceFile.size( ) > 0 )
+        write_trace( traceFile );
+
     return 0;
 }
@@ -0,0 +1,328 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  metrics.cpp
+ *
+ *    Description:  Time spent in each stage of stabilization, per-frame
+ *                  counters and events, written as JSON and Chrome trace.
+ *
+ *        Version:  1.0
+ *        Created:  10/26/2016 10:05:12 AM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#include "metrics.h"
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <sys/resource.h>
+
+/**
+ * @brief One entry of the Chrome trace: a stage ('X'), a counter ('C') or
+ * an event ('i').
+ */
+struct TraceEvent
+{
+    const char* name;
+    char phase;
+    unsigned tid;
+    long frame;
+    double start;                               /* us since the first timer. */
+    double value;                               /* Duration (us) or count. */
+};
+
+/**
+ * @brief Summary of a per-frame counter.
+ */
+struct CounterStats
+{
+    double sum = 0;
+    double min = 0;
+    double max = 0;
+    size_t count = 0;
+};
+
+/**
+ * @brief Stage totals of one thread. Only that thread adds to them, so its
+ * mutex is not contended; it is there for stage_stats( ) and
+ * reset_stage_stats( ). There are only a few stages, which are found by the
+ * address of their name.
+ */
+struct ThreadStages
+{
+    mutex m;
+    vector< pair< const char*, StageStats > > stats;
+};
+
+// Totals of every thread which timed a stage, kept after the thread exits.
+static mutex thread_stages_mutex_;
+static vector< shared_ptr< ThreadStages > > thread_stages_;
+
+// Everything below is only kept while recording.
+static mutex stage_mutex_;
+
+static atomic< bool > recording_( false );
+static map< string, CounterStats > counters_;
+static map< string, size_t > events_;
+static map< long, map< string, double > > frame_stages_;
+static vector< TraceEvent > trace_;
+
+static const chrono::steady_clock::time_point epoch_ = chrono::steady_clock::now( );
+static atomic< unsigned > num_threads_seen_( 0 );
+
+static thread_local long current_frame_ = -1;
+static thread_local unsigned thread_id_ = num_threads_seen_++;
+static thread_local shared_ptr< ThreadStages > my_stages_;
+
+static ThreadStages& my_stages( )
+{
+    if( ! my_stages_ )
+    {
+        my_stages_ = make_shared< ThreadStages >( );
+        lock_guard< mutex > lock( thread_stages_mutex_ );
+        thread_stages_.push_back( my_stages_ );
+    }
+    return *my_stages_;
+}
+
+static double us_since_epoch( chrono::steady_clock::time_point t )
+{
+    return chrono::duration< double, micro >( t - epoch_ ).count( );
+}
+
+StageTimer::StageTimer( const char* stage ) : 
+    stage_( stage )
+    , start_( chrono::steady_clock::now( ) )
+{
+}
+
+StageTimer::~StageTimer( )
+{
+    auto end = chrono::steady_clock::now( );
+    double seconds = chrono::duration< double >( end - start_ ).count( );
+
+    {
+        ThreadStages& t = my_stages( );
+        lock_guard< mutex > lock( t.m );
+        size_t i = 0;
+        while( i < t.stats.size( ) && t.stats[i].first != stage_ )
+            i++;
+        if( i == t.stats.size( ) )
+            t.stats.push_back( make_pair( stage_, StageStats( ) ) );
+        t.stats[i].second.seconds += seconds;
+        t.stats[i].second.calls += 1;
+    }
+
+    if( ! recording_ )
+        return;
+
+    lock_guard< mutex > lock( stage_mutex_ );
+    if( current_frame_ >= 0 )
+        frame_stages_[current_frame_][stage_] += seconds;
+
+    TraceEvent e = { stage_, 'X', thread_id_, current_frame_
+        , us_since_epoch( start_ ), seconds * 1e6 
+    };
+    trace_.push_back( e );
+}
+
+void reset_stage_stats( )
+{
+    {
+        lock_guard< mutex > lock( thread_stages_mutex_ );
+        for( auto& t : thread_stages_ )
+        {
+            lock_guard< mutex > tlock( t->m );
+            t->stats.clear( );
+        }
+    }
+
+    lock_guard< mutex > lock( stage_mutex_ );
+    counters_.clear( );
+    events_.clear( );
+    frame_stages_.clear( );
+    trace_.clear( );
+}
+
+map< string, StageStats > stage_stats( )
+{
+    map< string, StageStats > stats;
+    lock_guard< mutex > lock( thread_stages_mutex_ );
+    for( auto& t : thread_stages_ )
+    {
+        lock_guard< mutex > tlock( t->m );
+        for( auto& s : t->stats )
+        {
+            stats[s.first].seconds += s.second.seconds;
+            stats[s.first].calls += s.second.calls;
+        }
+    }
+    return stats;
+}
+
+void enable_recording( bool enable )
+{
+    recording_ = enable;
+}
+
+bool recording( )
+{
+    return recording_;
+}
+
+void set_current_frame( long frame )
+{
+    current_frame_ = frame;
+}
+
+long current_frame( )
+{
+    return current_frame_;
+}
+
+void record_count( const char* name, double value )
+{
+    if( ! recording_ )
+        return;
+
+    lock_guard< mutex > lock( stage_mutex_ );
+    CounterStats& c = counters_[name];
+    c.min = c.count ? min( c.min, value ) : value;
+    c.max = c.count ? max( c.max, value ) : value;
+    c.sum += value;
+    c.count += 1;
+
+    TraceEvent e = { name, 'C', thread_id_, current_frame_
+        , us_since_epoch( chrono::steady_clock::now( ) ), value 
+    };
+    trace_.push_back( e );
+}
+
+void record_event( const char* name )
+{
+    if( ! recording_ )
+        return;
+
+    lock_guard< mutex > lock( stage_mutex_ );
+    events_[name] += 1;
+
+    TraceEvent e = { name, 'i', thread_id_, current_frame_
+        , us_since_epoch( chrono::steady_clock::now( ) ), 0 
+    };
+    trace_.push_back( e );
+}
+
+double peak_rss_mb( )
+{
+    struct rusage usage;
+    if( getrusage( RUSAGE_SELF, &usage ) != 0 )
+        return 0;
+
+    // Linux reports kilobytes.
+    return usage.ru_maxrss / 1024.0;
+}
+
+bool write_metrics( const string& filename )
+{
+    ofstream out( filename.c_str( ) );
+    if( ! out )
+    {
+        std::cout << "[WARN] Could not write metrics to " << filename << std::endl;
+        return false;
+    }
+
+    out.precision( 12 );
+    map< string, StageStats > stats = stage_stats( );
+    lock_guard< mutex > lock( stage_mutex_ );
+    out << "{\n";
+    out << "  \"wall_seconds\": " << us_since_epoch( chrono::steady_clock::now( ) ) / 1e6 << ",\n";
+    out << "  \"peak_rss_mb\": " << peak_rss_mb( ) << ",\n";
+
+    out << "  \"stages\": {";
+    const char* sep = "\n";
+    for( auto& s : stats )
+    {
+        out << sep << "    \"" << s.first << "\": { \"seconds\": " << s.second.seconds
+            << ", \"calls\": " << s.second.calls << " }";
+        sep = ",\n";
+    }
+    out << "\n  },\n";
+
+    out << "  \"counters\": {";
+    sep = "\n";
+    for( auto& c : counters_ )
+    {
+        const CounterStats& v = c.second;
+        out << sep << "    \"" << c.first << "\": { \"mean\": " << v.sum / v.count
+            << ", \"min\": " << v.min << ", \"max\": " << v.max 
+            << ", \"count\": " << v.count << " }";
+        sep = ",\n";
+    }
+    out << "\n  },\n";
+
+    out << "  \"events\": {";
+    sep = "\n";
+    for( auto& e : events_ )
+    {
+        out << sep << "    \"" << e.first << "\": " << e.second;
+        sep = ",\n";
+    }
+    out << "\n  },\n";
+
+    out << "  \"frames\": [";
+    sep = "\n";
+    for( auto& f : frame_stages_ )
+    {
+        out << sep << "    { \"frame\": " << f.first;
+        for( auto& s : f.second )
+            out << ", \"" << s.first << "\": " << s.second;
+        out << " }";
+        sep = ",\n";
+    }
+    out << "\n  ]\n}\n";
+
+    std::cout << "[INFO] Wrote metrics to " << filename << std::endl;
+    return true;
+}
+
+bool write_trace( const string& filename )
+{
+    ofstream out( filename.c_str( ) );
+    if( ! out )
+    {
+        std::cout << "[WARN] Could not write trace to " << filename << std::endl;
+        return false;
+    }
+
+    out.precision( 12 );
+    lock_guard< mutex > lock( stage_mutex_ );
+    out << "{\"traceEvents\":[";
+    const char* sep = "\n";
+    for( auto& e : trace_ )
+    {
+        out << sep << "{\"name\":\"" << e.name << "\",\"ph\":\"" << e.phase 
+            << "\",\"pid\":1,\"tid\":" << e.tid << ",\"ts\":" << e.start;
+        if( e.phase == 'X' )
+            out << ",\"dur\":" << e.value << ",\"args\":{\"frame\":" << e.frame << "}";
+        else if( e.phase == 'C' )
+            out << ",\"args\":{\"" << e.name << "\":" << e.value << "}";
+        else
+            out << ",\"s\":\"t\",\"args\":{\"frame\":" << e.frame << "}";
+        out << "}";
+        sep = ",\n";
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+    std::cout << "[INFO] Wrote trace to " << filename << std::endl;
+    return true;
+}
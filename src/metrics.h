@@ -0,0 +1,106 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  metrics.h
+ *
+ *    Description:  Time spent in each stage of stabilization, per-frame
+ *                  counters and events, written as JSON and Chrome trace.
+ *
+ *        Version:  1.0
+ *        Created:  10/26/2016 10:05:12 AM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#ifndef  metrics_INC
+#define  metrics_INC
+
+#include <chrono>
+#include <map>
+#include <string>
+
+using namespace std;
+
+/**
+ * @brief Time spent in a stage, summed over all threads.
+ */
+struct StageStats
+{
+    double seconds = 0;
+    size_t calls = 0;
+};
+
+/**
+ * @brief Times the enclosing scope as one call of a stage: read, prefilter,
+ * detect, track, estimate, smooth, warp or write.
+ *
+ * Stage totals are always kept, per thread, and summed by stage_stats( ).
+ * Per-frame times and trace events are only recorded after
+ * enable_recording( true ).
+ */
+class StageTimer
+{
+public:
+    explicit StageTimer( const char* stage );
+    ~StageTimer( );
+
+private:
+    const char* stage_;
+    chrono::steady_clock::time_point start_;
+};
+
+void reset_stage_stats( );
+
+/**
+ * @brief Stats of every stage timed since the last reset_stage_stats( ).
+ */
+map< string, StageStats > stage_stats( );
+
+/**
+ * @brief Record per-frame times, counters and events for write_metrics( ) and
+ * write_trace( ). Off by default.
+ */
+void enable_recording( bool enable );
+bool recording( );
+
+/**
+ * @brief Frame the calling thread is working on; stage times, counters and
+ * events of this thread are attributed to it. -1 when not known.
+ */
+void set_current_frame( long frame );
+long current_frame( );
+
+/**
+ * @brief Value of a per-frame counter, e.g. the number of corners or inliers.
+ */
+void record_count( const char* name, double value );
+
+/**
+ * @brief Something which happened to the current frame, e.g. a fallback to
+ * the last good transform.
+ */
+void record_event( const char* name );
+
+/**
+ * @brief Peak resident memory of this process in MB.
+ */
+double peak_rss_mb( );
+
+/**
+ * @brief Stage totals, counters, events, peak memory and per-frame stage
+ * times as JSON.
+ */
+bool write_metrics( const string& filename );
+
+/**
+ * @brief Recorded stages, counters and events in the Chrome trace_event
+ * format (open in chrome://tracing or Perfetto).
+ */
+bool write_trace( const string& filename );
+
+#endif   /* ----- #ifndef metrics_INC  ----- */
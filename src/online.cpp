@@ -0,0 +1,442 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  online.cpp
+ *
+ *    Description:  Stabilize frames as they are acquired, read from a pipe or
+ *                  a watched directory.
+ *
+ *        Version:  1.0
+ *        Created:  11/08/2016 11:02:37 AM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#include "online.h"
+#include "videoio.h"
+#include "stablizer.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+// Without inotify, a watched directory is listed every quarter of the time
+// between frames, within ONLINE_POLL_MS. With inotify, an image which was not
+// seen closed is checked every ONLINE_SETTLE_MS. Reading stops when no new
+// image appeared for ONLINE_IDLE_SECONDS.
+const int ONLINE_POLL_MS[2] = { 1, 50 };
+const int ONLINE_SETTLE_MS = 100;
+const double ONLINE_IDLE_SECONDS = 10.0;
+
+static double seconds_since( chrono::steady_clock::time_point start )
+{
+    return chrono::duration< double >( chrono::steady_clock::now( ) - start ).count( );
+}
+
+static bool is_directory( const string& path )
+{
+    struct stat st;
+    return stat( path.c_str( ), &st ) == 0 && S_ISDIR( st.st_mode );
+}
+
+static bool is_fifo( const string& path )
+{
+    struct stat st;
+    return stat( path.c_str( ), &st ) == 0 && S_ISFIFO( st.st_mode );
+}
+
+static long file_size( const string& path )
+{
+    struct stat st;
+    if( stat( path.c_str( ), &st ) != 0 )
+        return -1;
+    return st.st_size;
+}
+
+static bool is_image( const string& name )
+{
+    string ext = file_extension( name );
+    return ext == "tif" || ext == "tiff" || ext == "png" || ext == "pgm";
+}
+
+/**
+ * @brief Add the images in dir whose name comes after the given one to names.
+ */
+static void images_after( const string& dir, const string& after, set< string >& names )
+{
+    DIR* d = opendir( dir.c_str( ) );
+    if( ! d )
+        return;
+
+    while( struct dirent* e = readdir( d ) )
+    {
+        string name = e->d_name;
+        if( name > after && is_image( name ) )
+            names.insert( name );
+    }
+    closedir( d );
+}
+
+/**
+ * @brief Read or write exactly n bytes, retrying on partial transfers.
+ *
+ * @return false on error or end of file.
+ */
+static bool read_fully( int fd, uchar* data, size_t n )
+{
+    while( n > 0 )
+    {
+        ssize_t r = ::read( fd, data, n );
+        if( r <= 0 )
+            return false;
+        data += r;
+        n -= r;
+    }
+    return true;
+}
+
+static bool write_fully( int fd, const uchar* data, size_t n )
+{
+    while( n > 0 )
+    {
+        ssize_t r = ::write( fd, data, n );
+        if( r <= 0 )
+            return false;
+        data += r;
+        n -= r;
+    }
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+ *  FrameSource
+ *-----------------------------------------------------------------------------*/
+FrameSource::FrameSource( ) : fd_( -1 ), watch_( -1 ), isDirectory_( false )
+    , pollMs_( ONLINE_POLL_MS[0] )
+{
+}
+
+FrameSource::~FrameSource( )
+{
+    close( );
+}
+
+bool FrameSource::open( const OnlineSource& source )
+{
+    close( );
+    source_ = source;
+    isDirectory_ = is_directory( source.path );
+    last_ = "";
+    queued_.clear( );
+    closed_.clear( );
+    if( isDirectory_ )
+    {
+#ifdef __linux__
+        // Watch before listing, so no image falls in between.
+        watch_ = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+        if( watch_ >= 0 && inotify_add_watch( watch_, source.path.c_str( )
+                    , IN_CLOSE_WRITE | IN_MOVED_TO ) < 0 )
+        {
+            ::close( watch_ );
+            watch_ = -1;
+        }
+#endif
+        if( watch_ < 0 )
+            std::cout << "[INFO] Polling " << source.path << " for new images." << std::endl;
+        images_after( source.path, last_, queued_ );
+        return true;
+    }
+
+    if( source.frameSize.area( ) == 0 )
+    {
+        std::cout << "[WARN] Size of the raw frames in " << source.path
+            << " is not set (--frame-size)." << std::endl;
+        return false;
+    }
+
+    fd_ = ( source.path == "-" ) ? 0 : ::open( source.path.c_str( ), O_RDONLY );
+    if( fd_ < 0 )
+    {
+        std::cout << "[WARN] Could not open " << source.path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void FrameSource::close( )
+{
+    if( fd_ > 0 )
+        ::close( fd_ );
+    if( watch_ >= 0 )
+        ::close( watch_ );
+    fd_ = -1;
+    watch_ = -1;
+}
+
+bool FrameSource::read_events( )
+{
+#ifdef __linux__
+    bool overflow = false;
+    alignas( struct inotify_event ) char buffer[16384];
+    ssize_t n;
+    while( ( n = ::read( watch_, buffer, sizeof( buffer ) ) ) > 0 )
+    {
+        for( char* p = buffer; p < buffer + n; )
+        {
+            const struct inotify_event* e = ( const struct inotify_event* ) p;
+            p += sizeof( struct inotify_event ) + e->len;
+
+            overflow = overflow || ( e->mask & IN_Q_OVERFLOW );
+            string name = e->len > 0 ? e->name : "";
+            if( ( e->mask & IN_ISDIR ) || name <= last_ || ! is_image( name ) )
+                continue;
+            queued_.insert( name );
+            closed_.insert( name );
+        }
+    }
+    return ! overflow;
+#else
+    return true;
+#endif
+}
+
+bool FrameSource::read( Mat& frame )
+{
+    return isDirectory_ ? read_image( frame ) : read_raw( frame );
+}
+
+bool FrameSource::read_raw( Mat& frame )
+{
+    if( fd_ < 0 )
+        return false;
+
+    // A new Mat every time, the stabilizer keeps the previous ones.
+    frame = Mat( source_.frameSize, source_.type );
+    if( read_fully( fd_, frame.data, frame.total( ) * frame.elemSize( ) ) )
+        return true;
+
+    frame = Mat( );
+    return false;
+}
+
+bool FrameSource::read_image( Mat& frame )
+{
+    /*-----------------------------------------------------------------------------
+     *  The acquisition may still be writing the oldest new image. It is read
+     *  once it was closed (inotify), a newer image exists, or its size did not
+     *  change between two checks. The directory is only listed again when
+     *  inotify is not available or lost events.
+     *-----------------------------------------------------------------------------*/
+    string candidate;
+    long candidateSize = -1;
+    auto idleSince = chrono::steady_clock::now( );
+
+    while( seconds_since( idleSince ) < ONLINE_IDLE_SECONDS )
+    {
+        if( watch_ >= 0 )
+        {
+            if( ! read_events( ) )
+                images_after( source_.path, last_, queued_ );
+        }
+        else if( queued_.size( ) < 2 )
+            images_after( source_.path, last_, queued_ );
+
+        if( queued_.empty( ) )
+        {
+            wait_for_images( );
+            continue;
+        }
+
+        string name = *queued_.begin( );
+        string path = source_.path + "/" + name;
+        long size = file_size( path );
+        bool newer = queued_.size( ) > 1;
+        bool settled = closed_.count( name ) > 0 
+            || ( name == candidate && size == candidateSize && size > 0 );
+        if( newer || settled )
+        {
+            Mat image = imread( path, IMREAD_UNCHANGED );
+            if( image.data || newer )
+            {
+                last_ = name;
+                queued_.erase( name );
+                closed_.erase( name );
+                if( ! image.data )
+                {
+                    std::cout << "[WARN] Could not read " << path << std::endl;
+                    continue;
+                }
+                update_poll_interval( );
+
+                // Not into frame, the stabilizer may still hold its buffer.
+                Mat grey = image;
+                if( image.channels( ) == 3 )
+                    cvtColor( image, grey, COLOR_BGR2GRAY );
+                else if( image.channels( ) == 4 )
+                    cvtColor( image, grey, COLOR_BGRA2GRAY );
+                frame = grey;
+                return true;
+            }
+        }
+
+        if( name != candidate || size != candidateSize )
+            idleSince = chrono::steady_clock::now( );
+        candidate = name;
+        candidateSize = size;
+        wait_for_images( );
+    }
+    return false;
+}
+
+void FrameSource::wait_for_images( )
+{
+    if( watch_ >= 0 )
+    {
+        // Until an image is closed, or to check the size of one which was not.
+        struct pollfd p = { watch_, POLLIN, 0 };
+        poll( &p, 1, ONLINE_SETTLE_MS );
+    }
+    else
+        this_thread::sleep_for( chrono::milliseconds( pollMs_ ) );
+}
+
+void FrameSource::update_poll_interval( )
+{
+    auto now = chrono::steady_clock::now( );
+    if( lastArrival_.time_since_epoch( ).count( ) > 0 )
+    {
+        double ms = 1e3 * chrono::duration< double >( now - lastArrival_ ).count( );
+        pollMs_ = ( int ) min( max( ms / 4, ( double ) ONLINE_POLL_MS[0] )
+                , ( double ) ONLINE_POLL_MS[1] );
+    }
+    lastArrival_ = now;
+}
+
+/*-----------------------------------------------------------------------------
+ *  Online stabilization
+ *-----------------------------------------------------------------------------*/
+static double percentile( vector< double > values, double p )
+{
+    if( values.empty( ) )
+        return 0;
+    size_t i = min( values.size( ) - 1, ( size_t ) ( p * values.size( ) ) );
+    nth_element( values.begin( ), values.begin( ) + i, values.end( ) );
+    return values[i];
+}
+
+static void report_times( const string& name, const vector< double >& ms )
+{
+    double sum = 0;
+    for( double v : ms )
+        sum += v;
+
+    std::cout << "[INFO]   " << setw( 12 ) << left << name << right
+        << fixed << setprecision( 2 )
+        << " mean " << setw( 7 ) << ( ms.empty( ) ? 0 : sum / ms.size( ) )
+        << "  p50 " << setw( 7 ) << percentile( ms, 0.5 )
+        << "  p99 " << setw( 7 ) << percentile( ms, 0.99 )
+        << "  max " << setw( 7 ) << percentile( ms, 1.0 ) << " ms" << std::endl;
+}
+
+void stabilize_online( const OnlineSource& source, const string& outfile
+        , size_t latency
+        )
+{
+    FrameSource reader;
+    if( ! reader.open( source ) )
+        return;
+
+    // Raw frames go to a FIFO, e.g. back to the acquisition.
+    int rawOut = -1;
+    FrameWriter writer;
+    if( is_fifo( outfile ) )
+    {
+        rawOut = ::open( outfile.c_str( ), O_WRONLY );
+        if( rawOut < 0 )
+        {
+            std::cout << "[WARN] Could not open " << outfile << std::endl;
+            return;
+        }
+    }
+    else if( ! writer.open( outfile, "" ) )
+        return;
+
+    Stabilizer stabilizer( latency );
+    std::cout << "[INFO] Frames are corrected " << stabilizer.latency( )
+        << " frames after they arrive." << std::endl;
+
+    // Per frame: latency, time spent waiting for it and time spent on it.
+    vector< double > latencies, waiting, processing;
+
+    Mat frame, corrected;
+    double ms = 0;
+    bool done = false;
+    while( ! done )
+    {
+        auto start = chrono::steady_clock::now( );
+        if( reader.read( frame ) )
+        {
+            waiting.push_back( 1e3 * seconds_since( start ) );
+            start = chrono::steady_clock::now( );
+            stabilizer.push( frame );
+        }
+        else
+        {
+            stabilizer.finish( );
+            done = true;
+        }
+
+        while( stabilizer.pop( corrected, &ms ) )
+        {
+            latencies.push_back( ms );
+            bool ok = ( rawOut >= 0 )
+                ? write_fully( rawOut, corrected.data, corrected.total( ) * corrected.elemSize( ) )
+                : writer.write( corrected );
+            if( ! ok )
+                throw runtime_error( "could not write " + outfile );
+        }
+
+        if( ! done )
+            processing.push_back( 1e3 * seconds_since( start ) );
+    }
+
+    if( rawOut >= 0 )
+        ::close( rawOut );
+    writer.close( );
+
+    std::cout << "[INFO] Corrected " << latencies.size( ) << " frames to "
+        << outfile << std::endl;
+    report_times( "latency", latencies );
+    report_times( "waiting", waiting );
+    report_times( "processing", processing );
+
+    // When frames come faster than they are processed, they queue up in the
+    // pipe or directory and the latency grows without bound.
+    double p99 = percentile( processing, 0.99 );
+    if( p99 > 0 )
+        std::cout << "[INFO] Keeps up with frame rates up to " << fixed 
+            << setprecision( 1 ) << 1e3 / p99 << " Hz (p99)." << std::endl;
+    if( ! reader.isDirectory( ) && percentile( waiting, 0.5 ) < 0.01 
+            && waiting.size( ) > 1 )
+        std::cout << "[WARN] Frames were mostly waiting in the pipe already,"
+            << " processing may not keep up." << std::endl;
+}
@@ -0,0 +1,108 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  online.h
+ *
+ *    Description:  Stabilize frames as they are acquired, read from a pipe or
+ *                  a watched directory.
+ *
+ *        Version:  1.0
+ *        Created:  11/08/2016 11:02:37 AM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#ifndef  online_INC
+#define  online_INC
+
+#include <chrono>
+#include <set>
+#include <string>
+#include "globals.h"
+
+/**
+ * @brief Where frames come from in online mode.
+ *
+ * A directory is watched for new images, which are read in the order of
+ * their names (number them with leading zeros). On Linux, inotify reports
+ * images as they are closed or moved in; otherwise the directory is listed
+ * at a fraction of the time between frames. Anything else is a pipe (- for
+ * stdin) of raw frames of frameSize and type, one after the other without
+ * header, in native byte order.
+ */
+struct OnlineSource
+{
+    string path;
+    Size frameSize;
+    int type = CV_16UC1;
+};
+
+/**
+ * @brief Reads the frames of an OnlineSource as they arrive.
+ */
+class FrameSource
+{
+public:
+    FrameSource( );
+    ~FrameSource( );
+
+    bool open( const OnlineSource& source );
+
+    /**
+     * @brief Wait for the next frame.
+     *
+     * @return false at the end of the pipe, or when no new image appeared in
+     * the directory for ONLINE_IDLE_SECONDS.
+     */
+    bool read( Mat& frame );
+    void close( );
+
+    bool isDirectory( ) const { return isDirectory_; }
+
+private:
+    bool read_raw( Mat& frame );
+    bool read_image( Mat& frame );
+
+    /**
+     * @brief Queue the images reported by inotify.
+     *
+     * @return false if events were lost, and the directory must be listed.
+     */
+    bool read_events( );
+    void wait_for_images( );
+    void update_poll_interval( );
+
+    OnlineSource source_;
+    int fd_;
+    int watch_;                                 /* inotify, -1 when polling. */
+    bool isDirectory_;
+    string last_;                               /* Last image read. */
+    set< string > queued_;                      /* Images after last_. */
+    set< string > closed_;                      /* Of those, the ones closed. */
+    int pollMs_;
+    chrono::steady_clock::time_point lastArrival_;
+};
+
+/**
+ * @brief Stabilize frames as they arrive from source and write them to
+ * outfile, see Stabilizer. A frame is written latency frames after it
+ * arrived (fewer if the smoother does not need that many).
+ *
+ * When outfile is a FIFO, corrected frames are passed on in the same raw
+ * format, e.g. to the closed loop; otherwise it is written by a FrameWriter.
+ * The per-frame latency and processing time are reported at the end.
+ *
+ * @param source
+ * @param outfile
+ * @param latency
+ */
+void stabilize_online( const OnlineSource& source, const string& outfile
+        , size_t latency 
+        );
+
+#endif   /* ----- #ifndef online_INC  ----- */
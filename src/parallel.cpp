@@ -0,0 +1,179 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  parallel.cpp
+ *
+ *    Description:  A small thread pool to run independent work items in
+ *                  parallel.
+ *
+ *        Version:  1.0
+ *        Created:  10/17/2016 11:04:15 AM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <memory>
+
+// True on threads which are running a chunk. Nested parallel_for calls run
+// serially instead of waiting on the pool they are part of.
+static thread_local bool in_parallel_region_ = false;
+
+ThreadPool::ThreadPool( size_t numThreads ) : stop_( false )
+{
+    // The calling thread also works, so start one thread less.
+    for (size_t i = 1; i < numThreads; i++) 
+        workers_.push_back( thread( &ThreadPool::worker_loop, this ) );
+}
+
+ThreadPool::~ThreadPool( )
+{
+    {
+        lock_guard< mutex > lock( mutex_ );
+        stop_ = true;
+    }
+    wake_.notify_all( );
+
+    for( auto& w : workers_ )
+        w.join( );
+}
+
+void ThreadPool::run_chunks( Job& job )
+{
+    in_parallel_region_ = true;
+    while( true )
+    {
+        size_t begin = job.next.fetch_add( job.chunk );
+        if( begin >= job.n )
+            break;
+
+        size_t end = min( begin + job.chunk, job.n );
+        try 
+        {
+            (*job.body)( begin, end );
+        }
+        catch( ... )
+        {
+            lock_guard< mutex > lock( mutex_ );
+            if( ! job.error )
+                job.error = current_exception( );
+
+            // Let the others stop early.
+            job.next = job.n;
+        }
+    }
+    in_parallel_region_ = false;
+}
+
+ThreadPool::Job* ThreadPool::next_job( )
+{
+    for( Job* job : jobs_ )
+        if( job->next < job->n )
+            return job;
+    return NULL;
+}
+
+void ThreadPool::worker_loop( )
+{
+    unique_lock< mutex > lock( mutex_ );
+    while( true )
+    {
+        Job* job = NULL;
+        wake_.wait( lock, [&]{ return stop_ || ( job = next_job( ) ) != NULL; } );
+        if( stop_ )
+            return;
+
+        job->active += 1;
+        lock.unlock( );
+        run_chunks( *job );
+        lock.lock( );
+
+        job->active -= 1;
+        if( job->active == 0 )
+            done_.notify_all( );
+    }
+}
+
+void ThreadPool::parallel_for( size_t n, size_t chunk, const range_body_t& body )
+{
+    if( n == 0 )
+        return;
+
+    if( chunk == 0 )
+        chunk = 1;
+
+    if( workers_.empty( ) || in_parallel_region_ || n <= chunk )
+    {
+        for (size_t begin = 0; begin < n; begin += chunk) 
+            body( begin, min( begin + chunk, n ) );
+        return;
+    }
+
+    Job job;
+    job.body = &body;
+    job.n = n;
+    job.chunk = chunk;
+    job.next = 0;
+    job.active = 1;
+    {
+        lock_guard< mutex > lock( mutex_ );
+        jobs_.push_back( &job );
+    }
+    wake_.notify_all( );
+
+    run_chunks( job );
+
+    {
+        // No chunks are left, so no worker joins any more. Wait for those
+        // which are still working on it.
+        unique_lock< mutex > lock( mutex_ );
+        jobs_.erase( find( jobs_.begin( ), jobs_.end( ), &job ) );
+        job.active -= 1;
+        done_.wait( lock, [&]{ return job.active == 0; } );
+    }
+
+    if( job.error )
+        rethrow_exception( job.error );
+}
+
+/*-----------------------------------------------------------------------------
+ *  Global pool.
+ *-----------------------------------------------------------------------------*/
+static size_t num_threads_ = 0;
+static unique_ptr< ThreadPool > pool_;
+static mutex pool_mutex_;
+
+void set_num_threads( size_t numThreads )
+{
+    lock_guard< mutex > lock( pool_mutex_ );
+    num_threads_ = numThreads;
+    pool_.reset( );
+}
+
+size_t get_num_threads( )
+{
+    if( num_threads_ > 0 )
+        return num_threads_;
+
+    size_t n = thread::hardware_concurrency( );
+    return n > 0 ? n : 1;
+}
+
+void parallel_for( size_t n, size_t chunk, const range_body_t& body )
+{
+    ThreadPool* pool = NULL;
+    {
+        lock_guard< mutex > lock( pool_mutex_ );
+        if( ! pool_ )
+            pool_.reset( new ThreadPool( get_num_threads( ) ) );
+        pool = pool_.get( );
+    }
+    pool->parallel_for( n, chunk, body );
+}
@@ -0,0 +1,102 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  parallel.h
+ *
+ *    Description:  A small thread pool to run independent work items in
+ *                  parallel.
+ *
+ *        Version:  1.0
+ *        Created:  10/17/2016 11:04:15 AM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#ifndef  parallel_INC
+#define  parallel_INC
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+typedef function< void( size_t, size_t ) > range_body_t;
+
+/**
+ * @brief Fixed size pool of worker threads.
+ *
+ * Work is handed out dynamically: every thread (including the caller) takes
+ * the next chunk of items from a shared counter, so threads which get cheap
+ * items simply take more chunks.
+ *
+ * Several threads may call parallel_for( ) at the same time, e.g. one per file
+ * in batch mode. Each caller works on its own job and idle workers join the
+ * oldest job which still has chunks left.
+ */
+class ThreadPool
+{
+public:
+    explicit ThreadPool( size_t numThreads );
+    ~ThreadPool( );
+
+    size_t size( ) const { return workers_.size( ) + 1; }
+
+    /**
+     * @brief Call body( begin, end ) for consecutive chunks of [0, n).
+     *
+     * Chunk boundaries are multiples of chunk and do not depend on the number
+     * of threads. Returns when all chunks are done. The first exception thrown
+     * by body is rethrown here.
+     */
+    void parallel_for( size_t n, size_t chunk, const range_body_t& body );
+
+private:
+    struct Job
+    {
+        const range_body_t* body;
+        size_t n;
+        size_t chunk;
+        atomic< size_t > next;
+        exception_ptr error;
+        size_t active;                          /* Threads working on it. */
+    };
+
+    void worker_loop( );
+    void run_chunks( Job& job );
+    Job* next_job( );
+
+    vector< thread > workers_;
+
+    mutex mutex_;
+    condition_variable wake_;
+    condition_variable done_;
+
+    // Jobs in the order they were started.
+    deque< Job* > jobs_;
+    bool stop_;
+};
+
+/**
+ * @brief Number of threads to use, 0 means one per core.
+ */
+void set_num_threads( size_t numThreads );
+size_t get_num_threads( );
+
+/**
+ * @brief Run body over [0, n) in chunks using the global thread pool. Calls
+ * from inside a worker run serially on that worker.
+ */
+void parallel_for( size_t n, size_t chunk, const range_body_t& body );
+
+#endif   /* ----- #ifndef parallel_INC  ----- */
@@ -0,0 +1,238 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  piecewise.cpp
+ *
+ *    Description:  Piecewise rigid (non-rigid) motion correction.
+ *
+ *        Version:  1.0
+ *        Created:  10/21/2016 10:05:52 AM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#include "piecewise.h"
+#include "estimator.h"
+#include "parallel.h"
+
+// Frames handed to a thread at a time when remapping.
+const size_t WARP_CHUNK = 4;
+
+// (frame, patch) pairs handed to a thread at a time.
+const size_t PATCH_CHUNK = 32;
+
+/**
+ * @brief Origins of patches of size patch along a side of length n, the last
+ * one flush with the end.
+ */
+static vector< int > patch_origins( int n, int patch, int overlap )
+{
+    vector< int > origins;
+    if( patch >= n )
+    {
+        origins.push_back( 0 );
+        return origins;
+    }
+
+    int stride = max( 1, patch - overlap );
+    for( int x = 0; x + patch < n; x += stride )
+        origins.push_back( x );
+    origins.push_back( n - patch );
+    return origins;
+}
+
+PatchGrid::PatchGrid( Size frameSize, int patchSize, int overlap )
+{
+    int pw = min( patchSize, frameSize.width );
+    int ph = min( patchSize, frameSize.height );
+    vector< int > xs = patch_origins( frameSize.width, pw, overlap );
+    vector< int > ys = patch_origins( frameSize.height, ph, overlap );
+
+    nx = xs.size( );
+    ny = ys.size( );
+    for( int y : ys )
+        centerY.push_back( y + ph / 2.0f );
+    for( int x : xs )
+        centerX.push_back( x + pw / 2.0f );
+
+    for( int y : ys )
+        for( int x : xs )
+            patches.push_back( Rect( x, y, pw, ph ) );
+}
+
+void mean_frame( const vector< Mat >& frames, Mat& mean )
+{
+    // Sums of the chunks are added in order afterwards, so that the mean does
+    // not depend on which thread finished first.
+    const size_t chunk = WARP_CHUNK * 4;
+    vector< Mat > sums( ( frames.size( ) + chunk - 1 ) / chunk );
+    parallel_for( frames.size( ), chunk, [&]( size_t begin, size_t end )
+            {
+                Mat sum = Mat::zeros( frames[0].size( ), CV_32F );
+                for (size_t k = begin; k < end; k++) 
+                    accumulate( frames[k], sum );
+                sums[begin / chunk] = sum;
+            }
+        );
+
+    mean = Mat::zeros( frames[0].size( ), CV_32F );
+    for( auto& sum : sums )
+        mean += sum;
+    mean /= ( double ) frames.size( );
+}
+
+/**
+ * @brief Interpolation index and weight of x between sorted centres: x lies
+ * between centres[i] and centres[i+1] with weight w on the latter.
+ */
+static void interpolation_weights( int n, const vector< float >& centres
+        , vector< int >& index, vector< float >& weight 
+        )
+{
+    index.resize( n );
+    weight.resize( n );
+    for (int x = 0; x < n; x++) 
+    {
+        size_t i = 0;
+        while( i + 2 < centres.size( ) && centres[i+1] <= x )
+            i++;
+
+        if( centres.size( ) == 1 )
+        {
+            index[x] = 0;
+            weight[x] = 0;
+            continue;
+        }
+
+        float w = ( x - centres[i] ) / ( centres[i+1] - centres[i] );
+        index[x] = i;
+        weight[x] = max( 0.0f, min( 1.0f, w ) );
+    }
+}
+
+/**
+ * @brief Remap frame by the shift field sampled at patch centres.
+ */
+static void remap_by_field( const Mat& frame, const PatchGrid& grid
+        , const Mat& sx, const Mat& sy
+        , const vector< int >& ix, const vector< float >& wx
+        , const vector< int >& iy, const vector< float >& wy
+        , Mat& result 
+        )
+{
+    Mat mapX( frame.size( ), CV_32F );
+    Mat mapY( frame.size( ), CV_32F );
+
+    int lastX = grid.nx - 1;
+    int lastY = grid.ny - 1;
+
+    for (int y = 0; y < frame.rows; y++) 
+    {
+        int i0 = iy[y];
+        int i1 = min( i0 + 1, lastY );
+        float v = wy[y];
+
+        float* mx = mapX.ptr<float>( y );
+        float* my = mapY.ptr<float>( y );
+        for (int x = 0; x < frame.cols; x++) 
+        {
+            int j0 = ix[x];
+            int j1 = min( j0 + 1, lastX );
+            float u = wx[x];
+
+            float dx = ( 1 - v ) * ( ( 1 - u ) * sx.at<float>( i0, j0 ) + u * sx.at<float>( i0, j1 ) )
+                + v * ( ( 1 - u ) * sx.at<float>( i1, j0 ) + u * sx.at<float>( i1, j1 ) );
+            float dy = ( 1 - v ) * ( ( 1 - u ) * sy.at<float>( i0, j0 ) + u * sy.at<float>( i0, j1 ) )
+                + v * ( ( 1 - u ) * sy.at<float>( i1, j0 ) + u * sy.at<float>( i1, j1 ) );
+
+            // Patch at p + s in the frame matches the template at p.
+            mx[x] = x + dx;
+            my[x] = y + dy;
+        }
+    }
+
+    remap( frame, result, mapX, mapY, INTER_LINEAR, BORDER_CONSTANT );
+}
+
+void correct_piecewise( const vector< Mat >& frames, vector< Mat >& result )
+{
+    if( frames.empty( ) )
+        return;
+
+    Size frameSize = frames[0].size( );
+    PatchGrid grid( frameSize, patch_size_, patch_overlap_ );
+    std::cout << "[INFO] Piecewise correction with " << grid.nx << " x " 
+        << grid.ny << " patches" << std::endl;
+
+    // Spectra of the template patches are computed once.
+    Mat templ;
+    mean_frame( frames, templ );
+
+    Mat window;
+    createHanningWindow( window, grid.patches[0].size( ), CV_32F );
+
+    vector< Mat > templSpectra( grid.size( ) );
+    parallel_for( grid.size( ), 1, [&]( size_t begin, size_t end )
+            {
+                for (size_t p = begin; p < end; p++) 
+                    windowed_spectrum( templ( grid.patches[p] ), window, templSpectra[p] );
+            }
+        );
+
+    // Shift of every patch of every frame. All of them are independent.
+    size_t numPatches = grid.size( );
+    vector< Point2f > shifts( frames.size( ) * numPatches );
+    parallel_for( shifts.size( ), PATCH_CHUNK, [&]( size_t begin, size_t end )
+            {
+                Mat F;
+                for (size_t i = begin; i < end; i++) 
+                {
+                    size_t k = i / numPatches;
+                    size_t p = i % numPatches;
+                    windowed_spectrum( frames[k]( grid.patches[p] ), window, F );
+                    Point2d s = phase_correlate_spectra( templSpectra[p], F );
+                    shifts[i] = Point2f( s.x, s.y );
+                }
+            }
+        );
+
+    // Per frame: limit, smooth and interpolate the shift field, then remap.
+    vector< int > ix, iy;
+    vector< float > wx, wy;
+    interpolation_weights( frameSize.width, grid.centerX, ix, wx );
+    interpolation_weights( frameSize.height, grid.centerY, iy, wy );
+
+    float maxShift = max_patch_shift_;
+    result.resize( frames.size( ) );
+    parallel_for( frames.size( ), WARP_CHUNK, [&]( size_t begin, size_t end )
+            {
+                for (size_t k = begin; k < end; k++) 
+                {
+                    Mat sx( grid.ny, grid.nx, CV_32F );
+                    Mat sy( grid.ny, grid.nx, CV_32F );
+                    for (size_t i = 0; i < grid.ny; i++) 
+                        for (size_t j = 0; j < grid.nx; j++) 
+                        {
+                            const Point2f& s = shifts[k * numPatches + i * grid.nx + j];
+                            sx.at<float>( i, j ) = max( -maxShift, min( maxShift, s.x ) );
+                            sy.at<float>( i, j ) = max( -maxShift, min( maxShift, s.y ) );
+                        }
+
+                    // A patch without texture gives a random shift, take the
+                    // median of its neighbourhood instead.
+                    if( grid.nx >= 3 && grid.ny >= 3 )
+                    {
+                        medianBlur( sx, sx, 3 );
+                        medianBlur( sy, sy, 3 );
+                    }
+
+                    remap_by_field( frames[k], grid, sx, sy, ix, wx, iy, wy, result[k] );
+                }
+            }
+        );
+}
@@ -0,0 +1,60 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  piecewise.h
+ *
+ *    Description:  Piecewise rigid (non-rigid) motion correction.
+ *
+ *        Version:  1.0
+ *        Created:  10/21/2016 10:05:52 AM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#ifndef  piecewise_INC
+#define  piecewise_INC
+
+#include "globals.h"
+
+/**
+ * @brief Grid of overlapping patches covering a frame.
+ */
+struct PatchGrid
+{
+    PatchGrid( Size frameSize, int patchSize, int overlap );
+
+    size_t size( ) const { return patches.size( ); }
+
+    vector< Rect > patches;                     /* Row major, ny x nx */
+    vector< float > centerX;                    /* Centre of every column of patches. */
+    vector< float > centerY;                    /* Centre of every row of patches. */
+    size_t nx;
+    size_t ny;
+};
+
+/**
+ * @brief Correct local deformation left after rigid stabilization.
+ *
+ * Every frame is split into overlapping patches of patch_size_ pixels
+ * (overlapping by patch_overlap_). The shift of each patch relative to the
+ * same patch of the mean frame is estimated by phase correlation; all patches
+ * of all frames are independent and are estimated in parallel. Per frame, the
+ * shifts are limited to max_patch_shift_, median filtered across neighbouring
+ * patches, interpolated to every pixel, and applied with a single remap.
+ *
+ * @param frames Rigidly stabilized frames.
+ * @param result Corrected frames.
+ */
+void correct_piecewise( const vector< Mat >& frames, vector< Mat >& result );
+
+/**
+ * @brief Mean of frames, as CV_32F.
+ */
+void mean_frame( const vector< Mat >& frames, Mat& mean );
+
+#endif   /* ----- #ifndef piecewise_INC  ----- */
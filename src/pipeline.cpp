@@ -0,0 +1,186 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  pipeline.cpp
+ *
+ *    Description:  Run reading, stabilization and writing concurrently,
+ *                  connected by bounded queues.
+ *
+ *        Version:  1.0
+ *        Created:  10/25/2016 02:14:40 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#include "pipeline.h"
+#include "videoio.h"
+#include "stablizer.h"
+#include "globals.h"
+
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+// Frames held between two stages. Bounds memory and lets a stage run ahead of
+// the next one by this much.
+const size_t PIPELINE_QUEUE_DEPTH = 32;
+
+struct CorrectedFrame
+{
+    Mat corrected;
+    Mat original;
+};
+
+static double seconds_since( chrono::steady_clock::time_point start )
+{
+    return chrono::duration< double >( chrono::steady_clock::now( ) - start ).count( );
+}
+
+static void report_stage( const string& name, double elapsed, double stall )
+{
+    std::cout << "[INFO]   " << setw( 10 ) << left << name << right 
+        << fixed << setprecision( 2 )
+        << setw( 8 ) << max( 0.0, elapsed - stall ) << " s busy" 
+        << setw( 8 ) << stall << " s stalled" << std::endl;
+}
+
+static void report_queue( const string& name, const QueueStats& s )
+{
+    std::cout << "[INFO]   " << setw( 10 ) << left << name << right 
+        << " depth max " << s.maxDepth << ", mean " 
+        << fixed << setprecision( 1 ) << s.meanDepth( ) 
+        << " of " << PIPELINE_QUEUE_DEPTH << std::endl;
+}
+
+void stabilize_pipelined( const string& infile, const string& outfile )
+{
+    video_info_t vInfo;
+    FrameReader reader;
+    if( ! reader.open( infile, vInfo ) )
+        return;
+
+    FrameWriter writer;
+    if( ! writer.open( outfile, infile, vInfo.numFrames ) )
+        return;
+
+    FrameWriter combinedWriter;
+    if( verbose_flag_ )
+        combinedWriter.open( "__combined.avi", infile );
+
+    SpscQueue< Mat > decoded( PIPELINE_QUEUE_DEPTH );
+    SpscQueue< CorrectedFrame > corrected( PIPELINE_QUEUE_DEPTH );
+    auto start = chrono::steady_clock::now( );
+
+    /*-----------------------------------------------------------------------------
+     *  Decoding and writing run on their own threads, stabilization on this
+     *  one. Closing a queue unblocks the thread at the other end, so an
+     *  exception in any stage stops the others.
+     *-----------------------------------------------------------------------------*/
+    exception_ptr readError, writeError;
+    double readTime = 0, writeTime = 0;
+    thread readThread( [&]( )
+            {
+                try
+                {
+                    Mat frame;
+                    while( reader.read( frame ) && decoded.push( frame ) )
+                        ;
+                }
+                catch( ... )
+                {
+                    readError = current_exception( );
+                }
+                decoded.close( );
+                readTime = seconds_since( start );
+            }
+        );
+
+    thread writeThread( [&]( )
+            {
+                try
+                {
+                    CorrectedFrame f;
+                    while( corrected.pop( f ) )
+                    {
+                        if( ! writer.write( f.corrected ) )
+                            throw runtime_error( "could not write " + outfile );
+                        if( verbose_flag_ )
+                        {
+                            Mat combined;
+                            hconcat( f.original, f.corrected, combined );
+                            combinedWriter.write( combined );
+                        }
+                    }
+                }
+                catch( ... )
+                {
+                    writeError = current_exception( );
+                }
+                corrected.close( );
+                writeTime = seconds_since( start );
+            }
+        );
+
+    exception_ptr stabilizeError;
+    try
+    {
+        StreamStabilizer stabilizer;
+        CorrectedFrame f;
+        Mat frame;
+        bool done = false;
+        while( ! done )
+        {
+            if( decoded.pop( frame ) )
+                stabilizer.push( frame );
+            else
+            {
+                stabilizer.finish( );
+                done = true;
+            }
+
+            while( stabilizer.pop( f.corrected, &f.original ) )
+            {
+                // The writer has stopped.
+                if( ! corrected.push( f ) )
+                {
+                    decoded.close( );
+                    done = true;
+                    break;
+                }
+            }
+        }
+    }
+    catch( ... )
+    {
+        stabilizeError = current_exception( );
+        decoded.close( );
+    }
+    corrected.close( );
+    double stabilizeTime = seconds_since( start );
+
+    readThread.join( );
+    writeThread.join( );
+    for( auto e : { readError, stabilizeError, writeError } )
+        if( e )
+            rethrow_exception( e );
+
+    double wall = seconds_since( start );
+    const QueueStats& d = decoded.stats( );
+    const QueueStats& c = corrected.stats( );
+
+    std::cout << "[INFO] Wrote " << writer.numFrames( ) << " corrected frames to "
+        << outfile << " in " << fixed << setprecision( 2 ) << wall << " s" << std::endl;
+    std::cout << "[INFO] Pipeline stages:" << std::endl;
+    report_stage( "read", readTime, d.pushStall );
+    report_stage( "stabilize", stabilizeTime, d.popStall + c.pushStall );
+    report_stage( "write", writeTime, c.popStall );
+    std::cout << "[INFO] Queues:" << std::endl;
+    report_queue( "decoded", d );
+    report_queue( "corrected", c );
+}
@@ -0,0 +1,166 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  pipeline.h
+ *
+ *    Description:  Run reading, stabilization and writing concurrently,
+ *                  connected by bounded queues.
+ *
+ *        Version:  1.0
+ *        Created:  10/25/2016 02:14:40 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#ifndef  pipeline_INC
+#define  pipeline_INC
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * @brief Counters of a SpscQueue. Each side only updates its own fields, read
+ * them once both sides are done.
+ */
+struct QueueStats
+{
+    double pushStall = 0;                       /* Seconds the producer waited. */
+    double popStall = 0;                        /* Seconds the consumer waited. */
+    size_t pushes = 0;
+    size_t maxDepth = 0;
+    double depthSum = 0;
+
+    double meanDepth( ) const { return pushes ? depthSum / pushes : 0; }
+};
+
+/**
+ * @brief Bounded lock-free queue with a single producer and a single consumer.
+ *
+ * push( ) blocks while the queue is full (backpressure) and pop( ) while it is
+ * empty. Either side may close( ) the queue: pop( ) then drains what is left
+ * and push( ) fails, so neither side waits for a peer which has stopped.
+ */
+template< typename T >
+class SpscQueue
+{
+public:
+    explicit SpscQueue( size_t capacity ) : 
+        buffer_( capacity + 1 )
+        , head_( 0 )
+        , tail_( 0 )
+        , closed_( false )
+    {
+    }
+
+    bool push( const T& item )
+    {
+        size_t t = tail_.load( memory_order_relaxed );
+        size_t next = ( t + 1 ) % buffer_.size( );
+        if( next == head_.load( memory_order_acquire ) )
+        {
+            auto start = chrono::steady_clock::now( );
+            int spins = 0;
+            while( next == head_.load( memory_order_acquire ) )
+            {
+                if( closed( ) )
+                    return false;
+                backoff( spins );
+            }
+            stats_.pushStall += seconds_since( start );
+        }
+        if( closed( ) )
+            return false;
+
+        buffer_[t] = item;
+        tail_.store( next, memory_order_release );
+
+        size_t depth = size( );
+        stats_.pushes += 1;
+        stats_.depthSum += depth;
+        stats_.maxDepth = max( stats_.maxDepth, depth );
+        return true;
+    }
+
+    /**
+     * @return false once the queue is closed and empty.
+     */
+    bool pop( T& item )
+    {
+        size_t h = head_.load( memory_order_relaxed );
+        if( h == tail_.load( memory_order_acquire ) )
+        {
+            auto start = chrono::steady_clock::now( );
+            int spins = 0;
+            while( h == tail_.load( memory_order_acquire ) )
+            {
+                if( closed( ) && h == tail_.load( memory_order_acquire ) )
+                {
+                    stats_.popStall += seconds_since( start );
+                    return false;
+                }
+                backoff( spins );
+            }
+            stats_.popStall += seconds_since( start );
+        }
+
+        item = buffer_[h];
+        buffer_[h] = T( );                      /* Release the slot's memory. */
+        head_.store( ( h + 1 ) % buffer_.size( ), memory_order_release );
+        return true;
+    }
+
+    void close( ) { closed_.store( true, memory_order_release ); }
+    bool closed( ) const { return closed_.load( memory_order_acquire ); }
+
+    size_t size( ) const
+    {
+        size_t h = head_.load( memory_order_acquire );
+        size_t t = tail_.load( memory_order_acquire );
+        return ( t + buffer_.size( ) - h ) % buffer_.size( );
+    }
+
+    const QueueStats& stats( ) const { return stats_; }
+
+private:
+    static void backoff( int& spins )
+    {
+        if( ++spins < 64 )
+            this_thread::yield( );
+        else
+            this_thread::sleep_for( chrono::microseconds( 50 ) );
+    }
+
+    static double seconds_since( chrono::steady_clock::time_point start )
+    {
+        return chrono::duration< double >( chrono::steady_clock::now( ) - start ).count( );
+    }
+
+    vector< T > buffer_;
+    atomic< size_t > head_;
+    atomic< size_t > tail_;
+    atomic< bool > closed_;
+    QueueStats stats_;
+};
+
+/**
+ * @brief Like stabilize_stream( ), but frames are decoded, stabilized and
+ * written on three threads at once. The wall-clock time is close to that of
+ * the slowest stage instead of the sum. Time spent by each stage and the
+ * queue depths are printed at the end.
+ *
+ * @param infile
+ * @param outfile
+ */
+void stabilize_pipelined( const string& infile, const string& outfile );
+
+#endif   /* ----- #ifndef pipeline_INC  ----- */
@@ -0,0 +1,167 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  registration.cpp
+ *
+ *    Description:  Rigid registration of every frame to a template.
+ *
+ *        Version:  1.0
+ *        Created:  12/02/2016 02:48:19 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#include "registration.h"
+#include "estimator.h"
+#include "piecewise.h"
+#include "parallel.h"
+#include "metrics.h"
+
+#include <iostream>
+
+// Frames registered by a thread at a time. Every chunk prepares the template
+// once, so chunks are larger than in Step 1. The result does not depend on
+// the number of threads.
+const size_t REGISTRATION_CHUNK = 64;
+
+// Iterations stop when no correction moved a pixel by more than this.
+const double TEMPLATE_TOLERANCE = 0.05;
+
+/**
+ * @brief Register every frame to templ.
+ */
+static void register_frames( const vector< Mat >& frames, const Mat& templ
+        , vector< TransformParam >& corrections
+        )
+{
+    vector< Mat > Ts( frames.size( ) );
+    parallel_for( frames.size( ), REGISTRATION_CHUNK, [&]( size_t begin, size_t end )
+            {
+                unique_ptr< MotionEstimator > estimator = make_estimator( );
+                estimator->set_reference( templ );
+                for (size_t k = begin; k < end; k++)
+                {
+                    set_current_frame( k );
+                    estimator->register_frame( frames[k], Ts[k] );
+                }
+                set_current_frame( -1 );
+            }
+        );
+
+    // The transforms map the template onto the frames, the corrections undo
+    // them. A frame which could not be registered gets the correction of the
+    // frame before, in order like estimate_transforms( ).
+    Mat last_T = Mat::eye( 2, 3, CV_64F );
+    corrections.clear( );
+    for (size_t k = 0; k < Ts.size( ); k++)
+    {
+        set_current_frame( k );
+        corrections.push_back( invert_transform( decompose_transform( Ts[k], last_T ) ) );
+    }
+    set_current_frame( -1 );
+}
+
+/**
+ * @brief Mean of the frames warped by their corrections, of the type of the
+ * frames.
+ */
+static void corrected_mean( const vector< Mat >& frames
+        , const vector< TransformParam >& corrections, Mat& templ
+        )
+{
+    StageTimer timer( "template" );
+
+    // Sums of the chunks are added in chunk order, not as threads finish.
+    vector< Mat > sums( ( frames.size( ) + REGISTRATION_CHUNK - 1 ) / REGISTRATION_CHUNK );
+    parallel_for( frames.size( ), REGISTRATION_CHUNK, [&]( size_t begin, size_t end )
+            {
+                Mat sum = Mat::zeros( frames[0].size( ), CV_32F );
+                Mat warped;
+                for (size_t k = begin; k < end; k++)
+                {
+                    warp_frame( frames[k], corrections[k], warped );
+                    accumulate( warped, sum );
+                }
+                sums[begin / REGISTRATION_CHUNK] = sum;
+            }
+        );
+
+    Mat mean = Mat::zeros( frames[0].size( ), CV_32F );
+    for( auto& sum : sums )
+        mean += sum;
+    mean /= ( double ) frames.size( );
+    mean.convertTo( templ, frames[0].type( ) );
+}
+
+/**
+ * @brief Largest distance between where a and b put a corner of a frame of
+ * the given size.
+ */
+static double max_displacement( const TransformParam& a, const TransformParam& b
+        , Size size
+        )
+{
+    double ca = cos( a.da ), sa = sin( a.da );
+    double cb = cos( b.da ), sb = sin( b.da );
+
+    double d = 0;
+    for( double x : { 0.0, size.width - 1.0 } )
+        for( double y : { 0.0, size.height - 1.0 } )
+        {
+            double ex = ( ca * x - sa * y + a.dx ) - ( cb * x - sb * y + b.dx );
+            double ey = ( sa * x + ca * y + a.dy ) - ( sb * x + cb * y + b.dy );
+            d = max( d, hypot( ex, ey ) );
+        }
+    return d;
+}
+
+void estimate_template_corrections( const vector< Mat >& frames
+        , vector< TransformParam >& corrections
+        )
+{
+    corrections.clear( );
+    if( frames.empty( ) )
+        return;
+
+    size_t numIterations = max( ( size_t ) 1, template_iterations_ );
+    size_t numFirst = max( ( size_t ) 1, min( template_frames_, frames.size( ) ) );
+
+    Mat templ;
+    {
+        StageTimer timer( "template" );
+        Mat mean;
+        mean_frame( vector< Mat >( frames.begin( ), frames.begin( ) + numFirst ), mean );
+        mean.convertTo( templ, frames[0].type( ) );
+    }
+
+    vector< TransformParam > previous;
+    for (size_t i = 0; i < numIterations; i++)
+    {
+        if( i > 0 )
+            corrected_mean( frames, corrections, templ );
+
+        previous.swap( corrections );
+        register_frames( frames, templ, corrections );
+
+        std::cout << "[INFO] Template iteration " << i + 1 << " out of " << numIterations;
+        if( previous.empty( ) )
+        {
+            std::cout << ", template of the first " << numFirst << " frames." << std::endl;
+            continue;
+        }
+
+        double change = 0;
+        for (size_t k = 0; k < corrections.size( ); k++)
+            change = max( change, max_displacement( corrections[k], previous[k]
+                        , frames[k].size( ) )
+                    );
+        std::cout << ", corrections moved by at most " << change << " px." << std::endl;
+        if( change < TEMPLATE_TOLERANCE )
+            break;
+    }
+}
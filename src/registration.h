@@ -0,0 +1,47 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  registration.h
+ *
+ *    Description:  Rigid registration of every frame to a template.
+ *
+ *        Version:  1.0
+ *        Created:  12/02/2016 02:48:19 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#ifndef  registration_INC
+#define  registration_INC
+
+#include "globals.h"
+#include "stablizer.h"
+
+/**
+ * @brief Correction of every frame by rigid registration to a template.
+ *
+ * Unlike the chain of pairs of estimate_corrections( ), every frame is
+ * registered to the same template, so errors do not add up to a drift and all
+ * frames are registered independently, in parallel. The first template is the
+ * mean of the first template_frames_ frames. Every further iteration
+ * registers the frames to the mean of the frames corrected by the iteration
+ * before, until template_iterations_ are done or no correction moves a pixel
+ * by more than TEMPLATE_TOLERANCE. The estimator (see make_estimator( ))
+ * prepares the template once per chunk of frames.
+ *
+ * The corrections are not smoothed, and every frame is corrected including
+ * the last one.
+ *
+ * @param frames
+ * @param corrections Correction of frame k, for apply_corrections( ).
+ */
+void estimate_template_corrections( const vector< Mat >& frames
+        , vector< TransformParam >& corrections
+        );
+
+#endif   /* ----- #ifndef registration_INC  ----- */
@@ -0,0 +1,248 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  smoother.cpp
+ *
+ *    Description:  Trajectory smoothers (Step 3 of the stabilizer).
+ *
+ *        Version:  1.0
+ *        Created:  10/18/2016 09:41:27 AM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#include "smoother.h"
+
+void TrajectorySmoother::smooth( const vector< Trajectory >& trajectory
+        , vector< Trajectory >& smoothed 
+        )
+{
+    reset( );
+    smoothed.clear( );
+    smoothed.reserve( trajectory.size( ) );
+
+    Trajectory s;
+    for( size_t i = 0; i < trajectory.size( ); i++ )
+    {
+        push( trajectory[i] );
+        while( pop( s ) )
+            smoothed.push_back( s );
+    }
+
+    finish( );
+    while( pop( s ) )
+        smoothed.push_back( s );
+}
+
+/*-----------------------------------------------------------------------------
+ *  BoxSmoother
+ *-----------------------------------------------------------------------------*/
+BoxSmoother::BoxSmoother( size_t radius ) : BoxSmoother( radius, radius )
+{
+}
+
+BoxSmoother::BoxSmoother( size_t radius, size_t lookahead ) : 
+    radius_( radius )
+    , ahead_( min( radius, lookahead ) )
+{
+    reset( );
+}
+
+void BoxSmoother::reset( )
+{
+    finished_ = false;
+    samples_.clear( );
+    first_ = 0;
+    last_ = 0;
+    received_ = 0;
+    next_ = 0;
+    sum_ = Trajectory( 0, 0, 0 );
+}
+
+void BoxSmoother::push( const Trajectory& t )
+{
+    samples_.push_back( t );
+    received_ += 1;
+}
+
+void BoxSmoother::finish( )
+{
+    finished_ = true;
+}
+
+bool BoxSmoother::pop( Trajectory& smoothed )
+{
+    if( next_ >= received_ )
+        return false;
+    if( ! finished_ && received_ <= next_ + ahead_ )
+        return false;
+
+    // Window of sample next_ is [next_ - radius, next_ + lookahead] cut to the
+    // samples which exist.
+    size_t hi = min( next_ + ahead_ + 1, received_ );
+    for( ; last_ < hi; last_++ )
+    {
+        const Trajectory& t = samples_[last_ - first_];
+        sum_.x += t.x;
+        sum_.y += t.y;
+        sum_.a += t.a;
+    }
+
+    while( first_ + radius_ < next_ )
+    {
+        const Trajectory& t = samples_.front( );
+        sum_.x -= t.x;
+        sum_.y -= t.y;
+        sum_.a -= t.a;
+        samples_.pop_front( );
+        first_ += 1;
+    }
+
+    double count = last_ - first_;
+    smoothed = Trajectory( sum_.x / count, sum_.y / count, sum_.a / count );
+    next_ += 1;
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+ *  GaussianSmoother
+ *-----------------------------------------------------------------------------*/
+GaussianSmoother::GaussianSmoother( size_t radius, size_t maxLookahead )
+{
+    // Three boxes of width w have variance 3 * ( w^2 - 1 ) / 12.
+    double sigma = radius / 3.0;
+    double w = sqrt( 4 * sigma * sigma + 1 );
+    size_t r = ( size_t ) round( ( w - 1 ) / 2 );
+    if( radius > 0 && r == 0 )
+        r = 1;
+
+    // The lookahead is shared evenly by the stages.
+    for (size_t i = 0; i < 3; i++) 
+    {
+        size_t ahead = maxLookahead / 3 + ( i < maxLookahead % 3 ? 1 : 0 );
+        stages_.push_back( BoxSmoother( r, ahead ) );
+    }
+}
+
+void GaussianSmoother::reset( )
+{
+    for( auto& s : stages_ )
+        s.reset( );
+}
+
+size_t GaussianSmoother::lookahead( ) const
+{
+    size_t n = 0;
+    for( auto& s : stages_ )
+        n += s.lookahead( );
+    return n;
+}
+
+void GaussianSmoother::forward( size_t stage )
+{
+    Trajectory t;
+    for( size_t i = stage; i + 1 < stages_.size( ); i++ )
+        while( stages_[i].pop( t ) )
+            stages_[i+1].push( t );
+}
+
+void GaussianSmoother::push( const Trajectory& t )
+{
+    stages_[0].push( t );
+    forward( 0 );
+}
+
+void GaussianSmoother::finish( )
+{
+    for( size_t i = 0; i < stages_.size( ); i++ )
+    {
+        stages_[i].finish( );
+        forward( i );
+    }
+}
+
+bool GaussianSmoother::pop( Trajectory& smoothed )
+{
+    return stages_.back( ).pop( smoothed );
+}
+
+/*-----------------------------------------------------------------------------
+ *  KalmanSmoother
+ *-----------------------------------------------------------------------------*/
+KalmanSmoother::KalmanSmoother( size_t radius ) : R_( 1.0 )
+{
+    // Steady state gain K of a random walk satisfies K^2 = ( Q / R ) ( 1 - K ).
+    double K = 1.0 / ( radius + 1.0 );
+    Q_ = ( K < 1.0 ) ? R_ * K * K / ( 1.0 - K ) : 1e6;
+    reset( );
+}
+
+void KalmanSmoother::reset( )
+{
+    initialized_ = false;
+    x_ = Trajectory( 0, 0, 0 );
+    P_ = Trajectory( 1, 1, 1 );
+    ready_.clear( );
+}
+
+static double kalman_update( double z, double& x, double& P, double Q, double R )
+{
+    // Predict: x stays, error grows by Q. Then correct with measurement z.
+    double P_ = P + Q;
+    double K = P_ / ( P_ + R );
+    x = x + K * ( z - x );
+    P = ( 1 - K ) * P_;
+    return x;
+}
+
+void KalmanSmoother::push( const Trajectory& t )
+{
+    if( ! initialized_ )
+    {
+        x_ = t;
+        initialized_ = true;
+    }
+    else
+    {
+        kalman_update( t.x, x_.x, P_.x, Q_, R_ );
+        kalman_update( t.y, x_.y, P_.y, Q_, R_ );
+        kalman_update( t.a, x_.a, P_.a, Q_, R_ );
+    }
+    ready_.push_back( x_ );
+}
+
+bool KalmanSmoother::pop( Trajectory& smoothed )
+{
+    if( ready_.empty( ) )
+        return false;
+    smoothed = ready_.front( );
+    ready_.pop_front( );
+    return true;
+}
+
+/*-----------------------------------------------------------------------------
+ *  Factory
+ *-----------------------------------------------------------------------------*/
+unique_ptr< TrajectorySmoother > make_smoother( const string& name, size_t radius
+        , size_t maxLookahead 
+        )
+{
+    unique_ptr< TrajectorySmoother > smoother;
+    if( name == "box" )
+        smoother.reset( new BoxSmoother( radius, maxLookahead ) );
+    else if( name == "gaussian" )
+        smoother.reset( new GaussianSmoother( radius, maxLookahead ) );
+    else if( name == "kalman" )
+        smoother.reset( new KalmanSmoother( radius ) );
+    return smoother;
+}
+
+unique_ptr< TrajectorySmoother > make_smoother( )
+{
+    return make_smoother( smoother_name_, smoothing_radius_ );
+}
@@ -0,0 +1,157 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  smoother.h
+ *
+ *    Description:  Trajectory smoothers (Step 3 of the stabilizer).
+ *
+ *        Version:  1.0
+ *        Created:  10/18/2016 09:41:27 AM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#ifndef  smoother_INC
+#define  smoother_INC
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include "globals.h"
+#include "stablizer.h"
+
+/**
+ * @brief Smooths a trajectory sample by sample.
+ *
+ * Samples are push( )ed in order and smoothed samples are pop( )ed in the same
+ * order as soon as they are known, i.e. after lookahead( ) more samples have
+ * been pushed or after finish( ). Every implementation costs O(1) per sample
+ * so smoothing is O(N) in the number of frames, whatever the radius.
+ */
+class TrajectorySmoother
+{
+public:
+    virtual ~TrajectorySmoother( ) {}
+
+    virtual void push( const Trajectory& t ) = 0;
+    virtual bool pop( Trajectory& smoothed ) = 0;
+    virtual void finish( ) = 0;
+    virtual void reset( ) = 0;
+
+    // Number of samples after sample i which are needed to smooth it.
+    virtual size_t lookahead( ) const = 0;
+
+    /**
+     * @brief Smooth a whole trajectory.
+     */
+    void smooth( const vector< Trajectory >& trajectory
+            , vector< Trajectory >& smoothed 
+            );
+};
+
+/**
+ * @brief Average over a window of radius samples on either side. Near the
+ * ends, the window is cut short. Uses a running sum.
+ *
+ * With a lookahead smaller than the radius, the window is radius samples
+ * behind and only lookahead samples ahead, e.g. 0 for a causal moving
+ * average. Such a window lags behind the trajectory.
+ */
+class BoxSmoother : public TrajectorySmoother
+{
+public:
+    explicit BoxSmoother( size_t radius );
+    BoxSmoother( size_t radius, size_t lookahead );
+
+    void push( const Trajectory& t );
+    bool pop( Trajectory& smoothed );
+    void finish( );
+    void reset( );
+    size_t lookahead( ) const { return ahead_; }
+
+private:
+    size_t radius_;
+    size_t ahead_;
+    bool finished_;
+
+    // Samples from index first_ onwards, and the sum of samples in the current
+    // window [first_, last_).
+    deque< Trajectory > samples_;
+    size_t first_;
+    size_t last_;
+    size_t received_;
+    size_t next_;
+    Trajectory sum_;
+};
+
+/**
+ * @brief Approximate Gaussian with sigma = radius / 3, computed as three
+ * cascaded box smoothers. The boxes look ahead at most maxLookahead samples
+ * in total, see BoxSmoother.
+ */
+class GaussianSmoother : public TrajectorySmoother
+{
+public:
+    explicit GaussianSmoother( size_t radius, size_t maxLookahead = SIZE_MAX );
+
+    void push( const Trajectory& t );
+    bool pop( Trajectory& smoothed );
+    void finish( );
+    void reset( );
+    size_t lookahead( ) const;
+
+private:
+    void forward( size_t stage );
+
+    vector< BoxSmoother > stages_;
+};
+
+/**
+ * @brief Causal Kalman filter on x, y and a, modelled as random walks. The
+ * process noise is chosen so that the steady state gain is 1 / ( radius + 1 ),
+ * which smooths about as much as a box of the same radius, but without
+ * looking ahead.
+ */
+class KalmanSmoother : public TrajectorySmoother
+{
+public:
+    explicit KalmanSmoother( size_t radius );
+
+    void push( const Trajectory& t );
+    bool pop( Trajectory& smoothed );
+    void finish( ) { }
+    void reset( );
+    size_t lookahead( ) const { return 0; }
+
+private:
+    double Q_;
+    double R_;
+
+    bool initialized_;
+    Trajectory x_;
+    Trajectory P_;
+
+    deque< Trajectory > ready_;
+};
+
+/**
+ * @brief Create the smoother by name: box, gaussian or kalman. Its
+ * lookahead( ) is at most maxLookahead samples.
+ *
+ * @return NULL if the name is unknown.
+ */
+unique_ptr< TrajectorySmoother > make_smoother( const string& name, size_t radius
+        , size_t maxLookahead = SIZE_MAX 
+        );
+
+/**
+ * @brief Create the smoother selected on the command line.
+ */
+unique_ptr< TrajectorySmoother > make_smoother( );
+
+#endif   /* ----- #ifndef smoother_INC  ----- */
@@ -18,92 +18,202 @@
 
 #include "stablizer.h"
 #include "globals.h"
+#include "parallel.h"
+#include "smoother.h"
+#include "estimator.h"
+#include "metrics.h"
+#include "framestore.h"
 
+#include <stdexcept>
 
-void stabilize( const vector< Mat >& frames, vector<Mat >& result )
+// Number of frames warped by a thread at a time in Step 5.
+const size_t WARP_CHUNK = 4;
+
+
+bool estimate_rigid_transform( const Mat& prev, const Mat& cur, Mat& T )
 {
-    // For further analysis
-#ifdef DEBUG
-    ofstream out_transform("__prev_to_cur_transformation.txt");
-    ofstream out_trajectory("__trajectory.txt");
-    ofstream out_smoothed_trajectory("__smoothed_trajectory.txt");
-    ofstream out_new_transform("__new_prev_to_cur_transformation.txt");
-#endif
+    unique_ptr< MotionEstimator > estimator = make_estimator( );
+    estimator->track( prev, T );
+    return estimator->track( cur, T );
+}
 
-    // Step 1 - Get previous to current frame transformation (dx, dy, da) for all frames
-    vector <TransformParam> prev_to_cur_transform; // previous to current
-    Mat last_T;
+TransformParam decompose_transform( const Mat& T, Mat& last_T )
+{
+    Mat T2 = T;
 
-    for (size_t k = 1; k < frames.size(); k++)
+    // in rare cases no transform is found. We'll just use the last known
+    // good transform, or no motion if there was none yet.
+    if(T2.data == NULL)
     {
-        Mat prev = frames[k-1];
-        Mat cur = frames[k];
-        // vector from prev to cur
-        vector <Point2f> prevCorner, curCorner;
-        vector <Point2f> prevCorner2, curCorner2;
-        vector <uchar> status;
-        vector <float> err;
-
-        /*-----------------------------------------------------------------------------
-         *  Function goodFeaturesToTrack works well with real video recordings
-         *  where feature sizes are large. 
-         *
-         *  To make it work with small feature sizes, we need to find as many
-         *  good feature points as possible. It probably a good idea to apply
-         *  bilinearFilter before continuing.
-         *-----------------------------------------------------------------------------*/
-
-        Mat curGrey; 
-        Mat prevGrey;
-
-        bilateralFilter( cur, curGrey, 9, 50, 50 );
-        bilateralFilter( prev, prevGrey, 9, 50, 50 );
-
-        size_t totalEntries = curGrey.cols * curGrey.rows;
-        goodFeaturesToTrack( prevGrey, prevCorner, totalEntries, 0.01, 1);
-        calcOpticalFlowPyrLK( prevGrey, curGrey, prevCorner, curCorner, status, err);
-
-        // weed out bad matches
-        for(size_t i=0; i < status.size(); i++)
-        {
-            if(status[i])
+        record_event( "fallback" );
+        if( last_T.data == NULL )
+            last_T = Mat::eye( 2, 3, CV_64F );
+        T2 = last_T;
+    }
+    else
+        last_T = T2;
+
+    // decompose T
+    double dx = T2.at<double>(0,2);
+    double dy = T2.at<double>(1,2);
+    double da = atan2(T2.at<double>(1,0), T2.at<double>(0,0));
+
+    return TransformParam(dx, dy, da);
+}
+
+void estimate_transforms( const vector< Mat >& frames
+        , vector< TransformParam >& prev_to_cur_transform 
+        )
+{
+    Mat last_T = Mat::eye( 2, 3, CV_64F );
+    estimate_transforms( frames, prev_to_cur_transform, last_T, 0 );
+}
+
+void estimate_transforms( const vector< Mat >& frames
+        , vector< TransformParam >& prev_to_cur_transform 
+        , Mat& last_T
+        , size_t firstFrame
+        )
+{
+    if( frames.size( ) < 2 )
+        return;
+
+    // Pairs are independent of each other. Estimate them in parallel and
+    // only then fall back to the last good transform, in order, so that the
+    // result does not depend on the number of threads.
+    // Within a chunk, the estimator reuses the work done on a frame for both
+    // pairs it is part of.
+    vector< Mat > Ts( frames.size( ) - 1 );
+    parallel_for( Ts.size( ), ESTIMATION_CHUNK, [&]( size_t begin, size_t end )
             {
-                prevCorner2.push_back(prevCorner[i]);
-                curCorner2.push_back(curCorner[i]);
+                unique_ptr< MotionEstimator > estimator = make_estimator( );
+                Mat T;
+                set_current_frame( firstFrame + begin );
+                estimator->track( frames[begin], T );
+                for (size_t k = begin; k < end; k++) 
+                {
+                    set_current_frame( firstFrame + k + 1 );
+                    estimator->track( frames[k+1], Ts[k] );
+                }
+                set_current_frame( -1 );
             }
-        }
+        );
 
-        // translation + rotation only
-        // false = rigid transform, no scaling/shearing
-        Mat T = estimateRigidTransform(prevCorner2, curCorner2, false);
+    for( size_t k = 0; k < Ts.size( ); k++ )
+    {
+        set_current_frame( firstFrame + k + 1 );
+        prev_to_cur_transform.push_back( decompose_transform( Ts[k], last_T ) );
+    }
+    set_current_frame( -1 );
+}
 
-        // in rare cases no transform is found. We'll just use the last known
-        // good transform.
-        if(T.data == NULL)
-            last_T.copyTo(T);
+void apply_transform( const Mat& cur, const TransformParam& t, Mat& result )
+{
+    StageTimer timer( "warp" );
 
-        T.copyTo(last_T);
+    // The width is only known now. Nothing would be left of the frame.
+    if( 2 * border_crop_ >= cur.cols )
+        throw runtime_error( "--border-crop " + to_string( border_crop_ ) 
+                + " is not less than half the width of the frames (" 
+                + to_string( cur.cols ) + ")"
+                );
 
-        // decompose T
-        double dx = T.at<double>(0,2);
-        double dy = T.at<double>(1,2);
-        double da = atan2(T.at<double>(1,0), T.at<double>(0,0));
+    // get the aspect ratio correct
+    int vert_border = border_crop_ * cur.rows / cur.cols;
+
+    /*-----------------------------------------------------------------------------
+     *  The border is cropped and the rest is resized back to cur size, for
+     *  better side by side comparison. Instead of warping, cropping and
+     *  resizing, the crop and scale are folded into the transform so that
+     *  every output pixel is interpolated once:
+     *
+     *      warped pixel w = T p, output pixel q with w = S q + o, so
+     *      q = S^-1 ( R p + t - o )
+     *
+     *  where S scales the cropped size to the full one and o is the corner of
+     *  the crop, shifted by half a pixel like resize( ) does.
+     *-----------------------------------------------------------------------------*/
+    double sx = ( cur.cols - 2.0 * border_crop_ ) / cur.cols;
+    double sy = ( cur.rows - 2.0 * vert_border ) / cur.rows;
+    double ox = border_crop_ + 0.5 * sx - 0.5;
+    double oy = vert_border + 0.5 * sy - 0.5;
 
-        prev_to_cur_transform.push_back(TransformParam(dx, dy, da));
+    Mat T(2,3,CV_64F);
+    T.at<double>(0,0) = cos(t.da) / sx;
+    T.at<double>(0,1) = -sin(t.da) / sx;
+    T.at<double>(1,0) = sin(t.da) / sy;
+    T.at<double>(1,1) = cos(t.da) / sy;
 
-#ifdef  DEBUG
-        out_transform << k << " " << dx << " " << dy << " " << da << endl;
-#endif     /* -----  not DEBUG  ----- */
+    T.at<double>(0,2) = ( t.dx - ox ) / sx;
+    T.at<double>(1,2) = ( t.dy - oy ) / sy;
 
-        curGrey.copyTo(prevGrey);
+    warpAffine(cur, result, T, cur.size());
+}
 
-#ifdef DBEUG
-        cout << "[DEBUG] Frame: " << k << "/" << frames.size()
-            << " - good optical flow: " << prevCorner2.size() << endl;
-#endif 
+TransformParam compose_transforms( const TransformParam& outer, const TransformParam& inner )
+{
+    // outer( inner( p ) ) = R(outer.da) * ( R(inner.da) * p + t_inner ) + t_outer
+    double c = cos( outer.da );
+    double s = sin( outer.da );
+    return TransformParam( c * inner.dx - s * inner.dy + outer.dx
+            , s * inner.dx + c * inner.dy + outer.dy
+            , inner.da + outer.da
+            );
+}
 
-    }
+TransformParam invert_transform( const TransformParam& t )
+{
+    // p = R(-da) * ( q - t )
+    double c = cos( t.da );
+    double s = sin( t.da );
+    return TransformParam( -( c * t.dx + s * t.dy ), -( -s * t.dx + c * t.dy ), -t.da );
+}
+
+void warp_frame( const Mat& cur, const TransformParam& t, Mat& result )
+{
+    StageTimer timer( "warp" );
+    Mat T(2,3,CV_64F);
+    T.at<double>(0,0) = cos(t.da);
+    T.at<double>(0,1) = -sin(t.da);
+    T.at<double>(1,0) = sin(t.da);
+    T.at<double>(1,1) = cos(t.da);
+    T.at<double>(0,2) = t.dx;
+    T.at<double>(1,2) = t.dy;
+
+    // Replicate the border so that the edge of the warped image does not
+    // produce corners which move with the correction instead of the content.
+    warpAffine(cur, result, T, cur.size(), INTER_LINEAR, BORDER_REPLICATE);
+}
+
+void estimate_corrections( const vector< Mat >& frames
+        , vector< TransformParam >& new_prev_to_cur_transform 
+        )
+{
+    // Step 1 - Get previous to current frame transformation (dx, dy, da) for all frames
+    vector <TransformParam> prev_to_cur_transform; // previous to current
+    estimate_transforms( frames, prev_to_cur_transform );
+    corrections_from_transforms( prev_to_cur_transform, new_prev_to_cur_transform );
+}
+
+void corrections_from_transforms( const vector< TransformParam >& prev_to_cur_transform
+        , vector< TransformParam >& new_prev_to_cur_transform 
+        )
+{
+    // For further analysis
+#ifdef DEBUG
+    ofstream out_transform("__prev_to_cur_transformation.txt");
+    ofstream out_trajectory("__trajectory.txt");
+    ofstream out_smoothed_trajectory("__smoothed_trajectory.txt");
+    ofstream out_new_transform("__new_prev_to_cur_transformation.txt");
+#endif
 
+#ifdef  DEBUG
+    for (size_t k = 0; k < prev_to_cur_transform.size(); k++)
+    {
+        const TransformParam& t = prev_to_cur_transform[k];
+        out_transform << k + 1 << " " << t.dx << " " << t.dy << " " << t.da << endl;
+    }
+#endif     /* -----  not DEBUG  ----- */
     // Step 2 - Accumulate the transformations to get the image trajectory
 
     // Accumulated frame to frame transform
@@ -125,43 +235,25 @@ void stabilize( const vector< Mat >& frames, vector<Mat >& result )
 #endif
     }
 
-    // Step 3 - Smooth out the trajectory using an averaging window
+    // Step 3 - Smooth out the trajectory
     vector <Trajectory> smoothed_trajectory; // trajectory at all frames
-
-    for(size_t i=0; i < trajectory.size(); i++)
     {
-        double sum_x = 0;
-        double sum_y = 0;
-        double sum_a = 0;
-        int count = 0;
-
-        for(int j = -SMOOTHING_RADIUS; j <= SMOOTHING_RADIUS; j++)
-        {
-            if(i+j >= 0 && i+j < trajectory.size())
-            {
-                sum_x += trajectory[i+j].x;
-                sum_y += trajectory[i+j].y;
-                sum_a += trajectory[i+j].a;
-
-                count++;
-            }
-        }
-
-        double avg_a = sum_a / count;
-        double avg_x = sum_x / count;
-        double avg_y = sum_y / count;
-
-        smoothed_trajectory.push_back(Trajectory(avg_x, avg_y, avg_a));
+        StageTimer timer( "smooth" );
+        make_smoother( )->smooth( trajectory, smoothed_trajectory );
+    }
 
 #ifdef DEBUG
-        out_smoothed_trajectory << (i+1) << " " << avg_x
-                                    << " " << avg_y << " " << avg_a << endl;
-#endif 
+    for(size_t i=0; i < smoothed_trajectory.size(); i++)
+    {
+        const Trajectory& s = smoothed_trajectory[i];
+        out_smoothed_trajectory << (i+1) << " " << s.x
+                                    << " " << s.y << " " << s.a << endl;
     }
+#endif 
 
     // Step 4 - Generate new set of previous to current transform, such that the
     // trajectory ends up being the same as the smoothed trajectory
-    vector <TransformParam> new_prev_to_cur_transform;
+    new_prev_to_cur_transform.clear( );
 
     // Accumulated frame to frame transform
     a = 0;
@@ -190,35 +282,290 @@ void stabilize( const vector< Mat >& frames, vector<Mat >& result )
 #endif
     }
 
-    // Step 5 - Apply the new transformation to the video
-    //inputVideo.set(CV_CAP_PROP_POS_FRAMES, 0);
-    Mat T(2,3,CV_64F);
+}
 
-    // get the aspect ratio correct
-    int vert_border = HORIZONTAL_BORDER_CROP * frames[0].rows / frames[0].cols;
+void apply_corrections( const vector< Mat >& frames
+        , const vector< TransformParam >& corrections
+        , vector< Mat >& result 
+        , size_t firstFrame
+        )
+{
+    size_t first = result.size( );
+    result.resize( first + corrections.size( ) );
+    for( size_t k = 0; k < corrections.size( ); k ++ )
+        result[first + k].create( frames[k].size( ), frames[k].type( ) );
+
+    // Headers sharing the data of the new frames.
+    vector< Mat > outputs( result.begin( ) + first, result.end( ) );
+    apply_corrections_into( frames, corrections, outputs, firstFrame );
+}
+
+void apply_corrections_into( const vector< Mat >& frames
+        , const vector< TransformParam >& corrections
+        , vector< Mat >& outputs 
+        , size_t firstFrame
+        )
+{
+    // Step 5 - Apply the new transformation to the video. Frames are warped
+    // in parallel, each into its own preallocated output.
+    parallel_for( corrections.size( ), WARP_CHUNK, [&]( size_t begin, size_t end )
+            {
+                for( size_t k = begin; k < end; k ++ )
+                {
+                    set_current_frame( firstFrame + k );
+                    apply_transform( frames[k], corrections[k], outputs[k] );
+                }
+                set_current_frame( -1 );
+            }
+        );
+}
 
-    for( size_t k = 0; k < frames.size() -1; k ++ )
+void stabilize( const vector< Mat >& frames, vector<Mat >& result )
+{
+    vector< TransformParam > corrections;
+    estimate_corrections( frames, corrections );
+    apply_corrections( frames, corrections, result );
+}
+
+void estimate_multipass_corrections( const vector< Mat >& frames
+        , size_t numPasses
+        , vector< TransformParam >& accumulated 
+        )
+{
+    // Accumulated correction of every frame w.r.t. the original frame.
+    accumulated.assign( frames.size( ), TransformParam( 0, 0, 0 ) );
+    FrameStore warpedStore;
+    vector< Mat > warped;
+
+    for (size_t pass = 0; pass < numPasses; pass++) 
     {
-        Mat cur = frames[k];
-        T.at<double>(0,0) = cos(new_prev_to_cur_transform[k].da);
-        T.at<double>(0,1) = -sin(new_prev_to_cur_transform[k].da);
-        T.at<double>(1,0) = sin(new_prev_to_cur_transform[k].da);
-        T.at<double>(1,1) = cos(new_prev_to_cur_transform[k].da);
+        std::cout << "[INFO] Running pass " << pass + 1 <<  " out of " << numPasses 
+            << std::endl;
+
+        // Motion is re-estimated on the original frames warped by the
+        // correction so far. Each of them is interpolated only once, from
+        // the original, and is used for estimation only.
+        const vector< Mat >* estimationFrames = &frames;
+        if( pass > 0 )
+        {
+            // Views of one store for all passes. Without it, warp_frame( )
+            // allocates every frame.
+            if( warpedStore.size( ) == 0 )
+                warpedStore.allocate( accumulated.size( ), frames[0].size( ), frames[0].type( ) );
+            warped = warpedStore.frames( );
+            warped.resize( accumulated.size( ) );
+            parallel_for( warped.size( ), ESTIMATION_CHUNK, [&]( size_t begin, size_t end )
+                    {
+                        for (size_t k = begin; k < end; k++) 
+                        {
+                            set_current_frame( k );
+                            warp_frame( frames[k], accumulated[k], warped[k] );
+                        }
+                        set_current_frame( -1 );
+                    }
+                );
+            estimationFrames = &warped;
+        }
 
-        T.at<double>(0,2) = new_prev_to_cur_transform[k].dx;
-        T.at<double>(1,2) = new_prev_to_cur_transform[k].dy;
+        vector< TransformParam > corrections;
+        estimate_corrections( *estimationFrames, corrections );
 
-        Mat cur2;
+        // Like stabilize( ), every pass drops the last frame.
+        accumulated.resize( corrections.size( ) );
+        for (size_t k = 0; k < corrections.size( ); k++) 
+            accumulated[k] = compose_transforms( corrections[k], accumulated[k] );
+    }
+}
+
+void stabilize_multipass( const vector< Mat >& frames
+        , size_t numPasses
+        , vector< Mat >& result 
+        )
+{
+    vector< TransformParam > accumulated;
+    estimate_multipass_corrections( frames, numPasses, accumulated );
+
+    // The only interpolation, crop and resize of the output.
+    apply_corrections( frames, accumulated, result );
+}
+
+/*-----------------------------------------------------------------------------
+ *  StreamStabilizer
+ *-----------------------------------------------------------------------------*/
+StreamStabilizer::StreamStabilizer( ) :
+    numPushed_( 0 )
+    , estimator_( make_estimator( ) )
+    , smoother_( make_smoother( ) )
+    , acc_( 0, 0, 0 )
+{
+}
+
+StreamStabilizer::~StreamStabilizer( )
+{
+}
+
+void StreamStabilizer::push( const Mat& frame )
+{
+    set_current_frame( numPushed_++ );
+    Mat T;
+    estimator_->track( frame, T );
+
+    if( prev_.data != NULL )
+    {
+        // Step 1 and 2 for the pair (prev, frame).
+        TransformParam t = decompose_transform( T, last_T_ );
+        acc_.x += t.dx;
+        acc_.y += t.dy;
+        acc_.a += t.da;
+
+        pending_.push_back( prev_ );
+        transforms_.push_back( t );
+        trajectory_.push_back( acc_ );
+        smoother_->push( acc_ );
+    }
+
+    prev_ = frame;
+    set_current_frame( -1 );
+    correct_ready_frames( );
+}
 
-        warpAffine(cur, cur2, T, cur.size());
+void StreamStabilizer::finish( )
+{
+    smoother_->finish( );
+    correct_ready_frames( );
+}
+
+bool StreamStabilizer::pop( Mat& corrected, Mat* original )
+{
+    if( corrected_.empty( ) )
+        return false;
+
+    corrected = corrected_.front( );
+    corrected_.pop_front( );
+    if( original )
+        *original = originals_.front( );
+    originals_.pop_front( );
+    return true;
+}
 
-        cur2 = cur2( Range(vert_border, cur2.rows-vert_border)
-                , Range(HORIZONTAL_BORDER_CROP, cur2.cols-HORIZONTAL_BORDER_CROP)
+void StreamStabilizer::correct_ready_frames( )
+{
+    // Step 3 - The smoother hands out smoothed samples, in order, as soon as
+    // it has seen enough of the trajectory.
+    Trajectory smoothed;
+    while( ! pending_.empty( ) && smoother_->pop( smoothed ) )
+    {
+        // Step 4 - New previous to current transform.
+        const TransformParam& t = transforms_.front( );
+        const Trajectory& traj = trajectory_.front( );
+        TransformParam newT( t.dx + smoothed.x - traj.x
+                , t.dy + smoothed.y - traj.y
+                , t.da + smoothed.a - traj.a
                 );
 
-        // Resize cur2 back to cur size, for better side by side comparison
-        resize(cur2, cur2, cur.size());
-        result.push_back( cur2 );
+        // Step 5 - Apply it.
+        Mat cur2;
+        apply_transform( pending_.front( ), newT, cur2 );
+        corrected_.push_back( cur2 );
+        originals_.push_back( pending_.front( ) );
+
+        pending_.pop_front( );
+        transforms_.pop_front( );
+        trajectory_.pop_front( );
+    }
+}
+
+/*-----------------------------------------------------------------------------
+ *  Stabilizer
+ *-----------------------------------------------------------------------------*/
+Stabilizer::Stabilizer( size_t latency ) :
+    numPushed_( 0 )
+    , estimator_( make_estimator( ) )
+    , smoother_( make_smoother( smoother_name_, smoothing_radius_, latency ) )
+    , acc_( 0, 0, 0 )
+{
+}
+
+Stabilizer::~Stabilizer( )
+{
+}
+
+size_t Stabilizer::latency( ) const
+{
+    return smoother_->lookahead( );
+}
+
+void Stabilizer::push( const Mat& frame )
+{
+    pushed_.push_back( chrono::steady_clock::now( ) );
+    set_current_frame( numPushed_ );
+    Mat T;
+    estimator_->track( frame, T );
+
+    // Step 1 and 2. The trajectory of frame k is the accumulated transform
+    // from the first frame to frame k.
+    if( numPushed_ > 0 )
+    {
+        TransformParam t = decompose_transform( T, last_T_ );
+        acc_.x += t.dx;
+        acc_.y += t.dy;
+        acc_.a += t.da;
     }
+    numPushed_ += 1;
+
+    pending_.push_back( frame );
+    trajectory_.push_back( acc_ );
+    smoother_->push( acc_ );
+
+    set_current_frame( -1 );
+    correct_ready_frames( );
 }
 
+void Stabilizer::finish( )
+{
+    smoother_->finish( );
+    correct_ready_frames( );
+}
+
+bool Stabilizer::pop( Mat& corrected, double* latency )
+{
+    if( corrected_.empty( ) )
+        return false;
+
+    corrected = corrected_.front( );
+    corrected_.pop_front( );
+    if( latency )
+        *latency = latencies_.front( );
+    latencies_.pop_front( );
+    return true;
+}
+
+void Stabilizer::correct_ready_frames( )
+{
+    Trajectory smoothed;
+    while( ! pending_.empty( ) && smoother_->pop( smoothed ) )
+    {
+        // Step 4 - Move frame k from its trajectory to the smoothed one.
+        const Trajectory& traj = trajectory_.front( );
+        TransformParam correction( smoothed.x - traj.x
+                , smoothed.y - traj.y
+                , smoothed.a - traj.a
+                );
+
+        // Step 5 - Apply it.
+        set_current_frame( numPushed_ - pending_.size( ) );
+        Mat cur2;
+        apply_transform( pending_.front( ), correction, cur2 );
+        corrected_.push_back( cur2 );
+        set_current_frame( -1 );
+
+        double ms = 1e3 * chrono::duration< double >( 
+                chrono::steady_clock::now( ) - pushed_.front( ) ).count( );
+        latencies_.push_back( ms );
+        record_count( "latency_ms", ms );
+
+        pending_.pop_front( );
+        trajectory_.pop_front( );
+        pushed_.pop_front( );
+    }
+}
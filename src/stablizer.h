@@ -19,21 +19,25 @@
 #ifndef  motion_stabilizer_INC
 #define  motion_stabilizer_INC
 
+#include <chrono>
+#include <deque>
+#include <memory>
 #include "globals.h"
 
+class TrajectorySmoother;
+class MotionEstimator;
 
-// This video stablisation smooths the global trajectory using a sliding average
-// window In frames. The larger the more stable the video, but less reactive to
-// sudden panning
-const int SMOOTHING_RADIUS = 50;
+// Number of frame pairs handed to a thread at a time in Step 1. Small enough
+// to balance pairs with very different feature counts across threads, large
+// enough for the estimator to carry corners and spectra from pair to pair.
+const size_t ESTIMATION_CHUNK = 16;
 
-// In pixels. Crops the border to reduce the black borders from stabilisation
-// being too noticeable.
-const int HORIZONTAL_BORDER_CROP = 10;
+// The smoothing radius, smoother and border crop are set on the command line,
+// see globals.h
 
 // 1. Get previous to current frame transformation (dx, dy, da) for all frames
 // 2. Accumulate the transformations to get the image trajectory
-// 3. Smooth out the trajectory using an averaging window
+// 3. Smooth out the trajectory using a TrajectorySmoother
 // 4. Generate new set of previous to current transform, such that the trajectory ends up being the same as the smoothed trajectory
 // 5. Apply the new transformation to the video
 
@@ -68,6 +72,116 @@ struct Trajectory
 };
 
 
+/**
+ * @brief Estimate rigid transform from prev to cur with the estimator selected
+ * on the command line (see estimator.h).
+ *
+ * @param prev
+ * @param cur
+ * @param T 2x3 transform, empty if none was found.
+ *
+ * @return false if no transform was found.
+ */
+bool estimate_rigid_transform( const Mat& prev, const Mat& cur, Mat& T );
+
+/**
+ * @brief Decompose rigid transform T into (dx, dy, da). When T is empty, the
+ * last good transform is used instead (identity if last_T is empty too);
+ * otherwise last_T is updated.
+ */
+TransformParam decompose_transform( const Mat& T, Mat& last_T );
+
+/**
+ * @brief Step 1 for all pairs of consecutive frames, using all threads (see
+ * set_num_threads( ) ). Result does not depend on the number of threads.
+ *
+ * @param frames
+ * @param prev_to_cur_transform
+ */
+void estimate_transforms( const vector< Mat >& frames
+        , vector< TransformParam >& prev_to_cur_transform 
+        );
+
+/**
+ * @brief Same for a block of a longer recording which starts at frame
+ * firstFrame. The transforms are appended, and last_T carries the last good
+ * transform from one block to the next. When firstFrame and the block length
+ * are multiples of ESTIMATION_CHUNK, the result is the same as for the whole
+ * recording at once.
+ */
+void estimate_transforms( const vector< Mat >& frames
+        , vector< TransformParam >& prev_to_cur_transform 
+        , Mat& last_T
+        , size_t firstFrame
+        );
+
+/**
+ * @brief Apply the new transform to a frame (Step 5 for one frame). The
+ * border is cropped and the result is resized back to the frame size.
+ *
+ * @param cur
+ * @param t
+ * @param result
+ */
+void apply_transform( const Mat& cur, const TransformParam& t, Mat& result );
+
+/**
+ * @brief Transform which applies inner first and then outer.
+ */
+TransformParam compose_transforms( const TransformParam& outer, const TransformParam& inner );
+
+/**
+ * @brief Transform which undoes t.
+ */
+TransformParam invert_transform( const TransformParam& t );
+
+/**
+ * @brief Warp a frame by t without cropping or resizing.
+ */
+void warp_frame( const Mat& cur, const TransformParam& t, Mat& result );
+
+/**
+ * @brief Step 1 to 4: compute the correction for every frame except the last
+ * one.
+ *
+ * @param frames
+ * @param new_prev_to_cur_transform Correction of frame k.
+ */
+void estimate_corrections( const vector< Mat >& frames
+        , vector< TransformParam >& new_prev_to_cur_transform 
+        );
+
+/**
+ * @brief Step 2 to 4 for transforms found by estimate_transforms( ).
+ *
+ * @param prev_to_cur_transform
+ * @param new_prev_to_cur_transform Correction of frame k.
+ */
+void corrections_from_transforms( const vector< TransformParam >& prev_to_cur_transform
+        , vector< TransformParam >& new_prev_to_cur_transform 
+        );
+
+/**
+ * @brief Step 5: apply corrections[k] to frames[k] using apply_transform( ).
+ * frames[0] is frame firstFrame of the recording, for metrics and traces.
+ */
+void apply_corrections( const vector< Mat >& frames
+        , const vector< TransformParam >& corrections
+        , vector< Mat >& result 
+        , size_t firstFrame = 0
+        );
+
+/**
+ * @brief Step 5 into outputs[k], which are already allocated with the size
+ * and type of frames[k], e.g. views of an ArrayFile. The corrected frames
+ * are written in place.
+ */
+void apply_corrections_into( const vector< Mat >& frames
+        , const vector< TransformParam >& corrections
+        , vector< Mat >& outputs 
+        , size_t firstFrame = 0
+        );
+
 /**
  * @brief Stablize the stack of frames.
  *
@@ -76,4 +190,135 @@ struct Trajectory
  */
 void stabilize( const vector< Mat >& frames , vector<Mat >& result );
 
+/**
+ * @brief Correction of every frame w.r.t. the original frame after numPasses
+ * passes. Every pass drops the last frame, like stabilize( ).
+ *
+ * @param frames
+ * @param numPasses
+ * @param accumulated Correction of frame k, for apply_corrections( ).
+ */
+void estimate_multipass_corrections( const vector< Mat >& frames
+        , size_t numPasses
+        , vector< TransformParam >& accumulated 
+        );
+
+/**
+ * @brief Stabilize the stack of frames in several passes.
+ *
+ * Unlike calling stabilize( ) numPasses times, later passes only re-estimate
+ * motion; the per-frame corrections are composed and the original frames are
+ * warped, cropped and resized once at the end.
+ *
+ * @param frames
+ * @param numPasses
+ * @param result
+ */
+void stabilize_multipass( const vector< Mat >& frames
+        , size_t numPasses
+        , vector< Mat >& result 
+        );
+
+/**
+ * @brief Stabilize a stream of frames with bounded memory.
+ *
+ * Does the same five steps as stabilize( ) but frame by frame: the smoother
+ * of Step 3 only needs lookahead( ) frames ahead, so at most lookahead( ) + 2
+ * frames are kept regardless of the recording length. The output is the same
+ * as stabilize( ) i.e. the last frame is dropped.
+ *
+ * Usage: push( ) every frame, pop( ) corrected frames as long as it returns
+ * true, call finish( ) after the last frame and pop( ) the rest.
+ */
+class StreamStabilizer
+{
+public:
+    StreamStabilizer( );
+    ~StreamStabilizer( );
+
+    void push( const Mat& frame );
+    bool pop( Mat& corrected, Mat* original = NULL );
+    void finish( );
+
+private:
+    void correct_ready_frames( );
+
+    Mat prev_;
+    Mat last_T_;
+    long numPushed_;
+
+    unique_ptr< MotionEstimator > estimator_;
+    unique_ptr< TrajectorySmoother > smoother_;
+
+    // Frames which are waiting for their smoothed trajectory, along with
+    // their previous to current transform and trajectory.
+    deque< Mat > pending_;
+    deque< TransformParam > transforms_;
+    deque< Trajectory > trajectory_;
+
+    // Accumulated frame to frame transform.
+    Trajectory acc_;
+
+    deque< Mat > corrected_;
+    deque< Mat > originals_;
+};
+
+/**
+ * @brief Online stabilizer for frames which arrive during acquisition.
+ *
+ * Unlike StreamStabilizer, frame k is corrected as soon as the smoother has
+ * seen latency( ) frames after it, and every frame is corrected including the
+ * last one. The smoother is cut to look at most latency frames ahead (see
+ * BoxSmoother), so with latency 0 it is causal. At most latency( ) + 1 frames
+ * are kept.
+ *
+ * Usage: push( ) every frame, pop( ) corrected frames as long as it returns
+ * true, call finish( ) after the last frame and pop( ) the rest. Frames are
+ * not copied, push( ) a new Mat every time.
+ */
+class Stabilizer
+{
+public:
+    explicit Stabilizer( size_t latency );
+    ~Stabilizer( );
+
+    void push( const Mat& frame );
+    void finish( );
+
+    /**
+     * @brief Next corrected frame.
+     *
+     * @param corrected
+     * @param latency Milliseconds between push( ) of the frame and the
+     * correction being ready, if not NULL.
+     *
+     * @return false if no corrected frame is ready yet.
+     */
+    bool pop( Mat& corrected, double* latency = NULL );
+
+    // Number of frames pushed after a frame before it is corrected.
+    size_t latency( ) const;
+
+private:
+    void correct_ready_frames( );
+
+    Mat last_T_;
+    long numPushed_;
+
+    unique_ptr< MotionEstimator > estimator_;
+    unique_ptr< TrajectorySmoother > smoother_;
+
+    // Frames waiting for their smoothed trajectory, with their trajectory and
+    // the time they were pushed.
+    deque< Mat > pending_;
+    deque< Trajectory > trajectory_;
+    deque< chrono::steady_clock::time_point > pushed_;
+
+    // Accumulated frame to frame transform.
+    Trajectory acc_;
+
+    deque< Mat > corrected_;
+    deque< double > latencies_;
+};
+
 #endif   /* ----- #ifndef motion_stabilizer_INC  ----- */
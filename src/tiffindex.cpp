@@ -0,0 +1,298 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  tiffindex.cpp
+ *
+ *    Description:  Index of the pages (IFDs) of a multi-page TIFF file for
+ *                  random access and parallel decoding.
+ *
+ *        Version:  1.0
+ *        Created:  10/24/2016 11:30:02 AM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#include "tiffindex.h"
+#include "globals.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <unordered_set>
+#include <sys/stat.h>
+
+// Pages handed to a thread at a time. Each chunk opens its own TIFF handle.
+const size_t TIFF_READ_CHUNK = 32;
+
+static const char IFDX_MAGIC[8] = { 'V', 'S', 'I', 'F', 'D', 'X', '0', '1' };
+
+/**
+ * @brief Reads integers of either byte order from a mapped TIFF file.
+ */
+struct TiffBytes
+{
+    const uchar* data;
+    uint64 size;
+    bool bigEndian;
+
+    bool get( uint64 pos, int bytes, uint64& value ) const
+    {
+        if( pos > size || ( uint64 ) bytes > size - pos )
+            return false;
+
+        value = 0;
+        for (int i = 0; i < bytes; i++) 
+        {
+            int shift = bigEndian ? 8 * ( bytes - 1 - i ) : 8 * i;
+            value |= ( uint64 ) data[pos + i] << shift;
+        }
+        return true;
+    }
+};
+
+/**
+ * @brief Follow the chain of IFDs of a classic or Big TIFF file.
+ *
+ * @return false if the file is not a TIFF file or the chain is broken.
+ */
+static bool walk_ifd_chain( const MappedFile& map, vector< uint64 >& offsets )
+{
+    offsets.clear( );
+
+    const uchar* d = map.data( );
+    if( d == NULL || map.size( ) < 8 )
+        return false;
+
+    TiffBytes b = { d, map.size( ), false };
+    if( d[0] == 'M' && d[1] == 'M' )
+        b.bigEndian = true;
+    else if( ! ( d[0] == 'I' && d[1] == 'I' ) )
+        return false;
+
+    uint64 version = 0, off = 0;
+    int countBytes, entryBytes, offsetBytes;
+    b.get( 2, 2, version );
+    if( version == 42 )
+    {
+        countBytes = 2;
+        entryBytes = 12;
+        offsetBytes = 4;
+        b.get( 4, 4, off );
+    }
+    else if( version == 43 )
+    {
+        countBytes = 8;
+        entryBytes = 20;
+        offsetBytes = 8;
+        b.get( 8, 8, off );
+    }
+    else
+        return false;
+
+    unordered_set< uint64 > seen;
+    while( off != 0 )
+    {
+        // A chain which loops back is broken.
+        if( ! seen.insert( off ).second )
+            return false;
+
+        uint64 count = 0, next = 0;
+        if( ! b.get( off, countBytes, count ) )
+            return false;
+
+        // A corrupt (BigTIFF) count could wrap the position of the next offset
+        // around and past the bounds check.
+        if( count > ( map.size( ) - off - countBytes ) / entryBytes )
+            return false;
+        if( ! b.get( off + countBytes + count * entryBytes, offsetBytes, next ) )
+            return false;
+
+        offsets.push_back( off );
+        off = next;
+    }
+    return ! offsets.empty( );
+}
+
+bool TiffIndex::build( const string& filename )
+{
+    filename_ = filename;
+    offsets_.clear( );
+
+    struct stat st;
+    if( stat( filename.c_str( ), &st ) != 0 )
+        return false;
+
+    string cachefile = filename + ".ifdx";
+    if( tiff_index_cache_ && load_cache( cachefile, st.st_size, st.st_mtime ) )
+        return true;
+
+    MappedFile map;
+    if( ! ( map.open( filename ) && walk_ifd_chain( map, offsets_ ) ) )
+    {
+        // Let libtiff do it.
+        offsets_.clear( );
+        TIFF* tif = TIFFOpen( filename.c_str( ), "r" );
+        if( ! tif )
+            return false;
+
+        do
+            offsets_.push_back( TIFFCurrentDirOffset( tif ) );
+        while( TIFFReadDirectory( tif ) );
+        TIFFClose( tif );
+    }
+
+    if( tiff_index_cache_ )
+        save_cache( cachefile, st.st_size, st.st_mtime );
+    return ! offsets_.empty( );
+}
+
+bool TiffIndex::load_cache( const string& cachefile, uint64 fileSize, int64 mtime )
+{
+    ifstream in( cachefile.c_str( ), ios::binary );
+    if( ! in )
+        return false;
+
+    char magic[8];
+    uint64 size = 0, count = 0;
+    int64 time = 0;
+    in.read( magic, 8 );
+    in.read( ( char* ) &size, sizeof( size ) );
+    in.read( ( char* ) &time, sizeof( time ) );
+    in.read( ( char* ) &count, sizeof( count ) );
+    if( ! in || memcmp( magic, IFDX_MAGIC, 8 ) != 0 )
+        return false;
+
+    // The file has changed since the index was written.
+    if( size != fileSize || time != mtime || count == 0 )
+        return false;
+
+    // A truncated or corrupt cache is built again. The header is the magic
+    // and three uint64.
+    in.seekg( 0, ios::end );
+    uint64 cacheBytes = in.tellg( );
+    if( ! in || cacheBytes < 32 || count != ( cacheBytes - 32 ) / sizeof( uint64 )
+            || ( cacheBytes - 32 ) % sizeof( uint64 ) != 0 )
+        return false;
+
+    in.seekg( 32 );
+    offsets_.resize( count );
+    in.read( ( char* ) &offsets_[0], count * sizeof( uint64 ) );
+
+    // An IFD is somewhere after the TIFF header.
+    bool ok = ( bool ) in;
+    for( size_t i = 0; ok && i < offsets_.size( ); i++ )
+        ok = offsets_[i] >= 8 && offsets_[i] < fileSize;
+    if( ! ok )
+        offsets_.clear( );
+    return ok;
+}
+
+void TiffIndex::save_cache( const string& cachefile, uint64 fileSize, int64 mtime ) const
+{
+    if( offsets_.empty( ) )
+        return;
+
+    // The directory may not be writable, the index is only a cache. Nothing
+    // is reported either way.
+    ofstream out( cachefile.c_str( ), ios::binary );
+    if( ! out )
+        return;
+
+    uint64 count = offsets_.size( );
+    out.write( IFDX_MAGIC, 8 );
+    out.write( ( const char* ) &fileSize, sizeof( fileSize ) );
+    out.write( ( const char* ) &mtime, sizeof( mtime ) );
+    out.write( ( const char* ) &count, sizeof( count ) );
+    out.write( ( const char* ) &offsets_[0], count * sizeof( uint64 ) );
+}
+
+bool seek_tiff_page( TIFF* tif, const TiffIndex& index, size_t i )
+{
+    if( i >= index.size( ) )
+        return false;
+    return TIFFSetSubDirectory( tif, index.offset( i ) ) != 0;
+}
+
+void read_tiff_frames( const TiffIndex& index, size_t begin, size_t end
+        , vector< Mat >& frames 
+        )
+{
+    end = min( end, index.size( ) );
+    if( begin >= end )
+        return;
+
+    MappedFile map;
+    map.open( index.filename( ) );
+
+    vector< Mat > decoded( end - begin );
+    parallel_for( decoded.size( ), TIFF_READ_CHUNK, [&]( size_t b, size_t e )
+            {
+                TIFF* tif = TIFFOpen( index.filename( ).c_str( ), "r" );
+                if( ! tif )
+                    return;
+
+                for (size_t i = b; i < e; i++) 
+                    if( seek_tiff_page( tif, index, begin + i ) )
+                        read_tiff_page( tif, decoded[i], &map );
+
+                TIFFClose( tif );
+            }
+        );
+
+    // Pages which could not be decoded become black frames, so that frames
+    // keep their index. Without any decoded page there is nothing to go by.
+    const Mat* good = NULL;
+    for( auto& f : decoded )
+        if( f.data != NULL && ! good )
+            good = &f;
+    if( ! good )
+        return;
+
+    for (size_t i = 0; i < decoded.size( ); i++)
+    {
+        if( decoded[i].data == NULL )
+        {
+            std::cout << "[WARN] Could not read page " << begin + i << " of " 
+                << index.filename( ) << ", it is replaced by a black frame." << std::endl;
+            decoded[i] = Mat::zeros( good->size( ), good->type( ) );
+        }
+        frames.push_back( decoded[i] );
+    }
+}
+
+bool read_tiff_frames_into( const TiffIndex& index, size_t begin, vector< Mat >& frames )
+{
+    if( begin + frames.size( ) > index.size( ) )
+        return false;
+
+    MappedFile map;
+    map.open( index.filename( ) );
+
+    vector< uchar > decoded( frames.size( ), 0 );
+    parallel_for( frames.size( ), TIFF_READ_CHUNK, [&]( size_t b, size_t e )
+            {
+                TIFF* tif = TIFFOpen( index.filename( ).c_str( ), "r" );
+                if( ! tif )
+                    return;
+
+                // A page of another size or type is decoded elsewhere and
+                // does not count.
+                for (size_t i = b; i < e; i++) 
+                {
+                    Mat page = frames[i];
+                    decoded[i] = seek_tiff_page( tif, index, begin + i ) 
+                        && read_tiff_page( tif, page, &map ) && page.data == frames[i].data;
+                }
+
+                TIFFClose( tif );
+            }
+        );
+    return count( decoded.begin( ), decoded.end( ), 0 ) == 0;
+}
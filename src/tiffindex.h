@@ -0,0 +1,79 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  tiffindex.h
+ *
+ *    Description:  Index of the pages (IFDs) of a multi-page TIFF file for
+ *                  random access and parallel decoding.
+ *
+ *        Version:  1.0
+ *        Created:  10/24/2016 11:30:02 AM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#ifndef  tiffindex_INC
+#define  tiffindex_INC
+
+#include "videoio.h"
+
+/**
+ * @brief File offset of every page (IFD) of a TIFF or BigTIFF file.
+ *
+ * Built once when the file is opened by following the chain of IFDs, without
+ * decoding any tag. The index is cached next to the file (filename.ifdx) when
+ * tiff_index_cache_ is set, and reused as long as the file size and
+ * modification time do not change. With it, any page is one seek away.
+ */
+class TiffIndex
+{
+public:
+    bool build( const string& filename );
+
+    size_t size( ) const { return offsets_.size( ); }
+    uint64 offset( size_t i ) const { return offsets_[i]; }
+    const string& filename( ) const { return filename_; }
+
+private:
+    bool load_cache( const string& cachefile, uint64 fileSize, int64 mtime );
+    void save_cache( const string& cachefile, uint64 fileSize, int64 mtime ) const;
+
+    string filename_;
+    vector< uint64 > offsets_;
+};
+
+/**
+ * @brief Make page i of the indexed file the current directory of tif.
+ */
+bool seek_tiff_page( TIFF* tif, const TiffIndex& index, size_t i );
+
+/**
+ * @brief Decode pages [begin, end) in parallel. Every thread opens its own
+ * TIFF handle. Pages which can not be decoded are black frames of the size of
+ * the others, so frames keep their index; nothing is read if no page could be
+ * decoded.
+ *
+ * @param index
+ * @param begin
+ * @param end
+ * @param frames Decoded frames, in page order.
+ */
+void read_tiff_frames( const TiffIndex& index, size_t begin, size_t end
+        , vector< Mat >& frames 
+        );
+
+/**
+ * @brief Decode pages [begin, begin + frames.size( )) in parallel into frames,
+ * which are already allocated with the size and type of the pages, e.g. views
+ * of a FrameStore.
+ *
+ * @return false if a page could not be decoded into its frame.
+ */
+bool read_tiff_frames_into( const TiffIndex& index, size_t begin, vector< Mat >& frames );
+
+#endif   /* ----- #ifndef tiffindex_INC  ----- */
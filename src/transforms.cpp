@@ -0,0 +1,150 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  transforms.cpp
+ *
+ *    Description:  Read and write the per-frame corrections (sidecar file), so
+ *                  that motion estimated on one stack can be applied to others.
+ *
+ *        Version:  1.0
+ *        Created:  10/27/2016 04:40:19 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#include "transforms.h"
+#include "videoio.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+static const char TRANSFORMS_MAGIC[8] = { 'V', 'S', 'T', 'R', 'A', 'N', 'S', '1' };
+
+bool write_transforms( const string& filename
+        , const vector< TransformParam >& corrections
+        , Size frameSize 
+        )
+{
+    ofstream out( filename.c_str( ), ios::binary );
+    if( ! out )
+    {
+        std::cout << "[WARN] Could not write transforms to " << filename << std::endl;
+        return false;
+    }
+
+    if( file_extension( filename ) == "csv" )
+    {
+        // Enough digits to read back the same doubles.
+        out.precision( 17 );
+        out << "# videostab corrections, frame size " << frameSize.width 
+            << "x" << frameSize.height << "\n";
+        out << "frame,dx,dy,da\n";
+        for (size_t k = 0; k < corrections.size( ); k++) 
+        {
+            const TransformParam& t = corrections[k];
+            out << k << "," << t.dx << "," << t.dy << "," << t.da << "\n";
+        }
+    }
+    else
+    {
+        int32_t size[2] = { frameSize.width, frameSize.height };
+        uint64_t n = corrections.size( );
+        out.write( TRANSFORMS_MAGIC, 8 );
+        out.write( ( const char* ) size, sizeof( size ) );
+        out.write( ( const char* ) &n, sizeof( n ) );
+        for( auto& t : corrections )
+        {
+            double v[3] = { t.dx, t.dy, t.da };
+            out.write( ( const char* ) v, sizeof( v ) );
+        }
+    }
+
+    std::cout << "[INFO] Wrote " << corrections.size( ) << " transforms to " 
+        << filename << std::endl;
+    return bool( out );
+}
+
+bool read_transforms( const string& filename
+        , vector< TransformParam >& corrections
+        , Size& frameSize 
+        )
+{
+    corrections.clear( );
+    ifstream in( filename.c_str( ), ios::binary );
+    if( ! in )
+    {
+        std::cout << "[WARN] Could not read transforms from " << filename << std::endl;
+        return false;
+    }
+
+    char magic[8] = { 0 };
+    in.read( magic, 8 );
+    if( in && memcmp( magic, TRANSFORMS_MAGIC, 8 ) == 0 )
+    {
+        int32_t size[2] = { 0, 0 };
+        uint64_t n = 0;
+        in.read( ( char* ) size, sizeof( size ) );
+        in.read( ( char* ) &n, sizeof( n ) );
+        frameSize = Size( size[0], size[1] );
+        for (uint64_t k = 0; k < n && in; k++) 
+        {
+            double v[3];
+            in.read( ( char* ) v, sizeof( v ) );
+            if( in )
+                corrections.push_back( TransformParam( v[0], v[1], v[2] ) );
+        }
+        return corrections.size( ) == n;
+    }
+
+    // Text: comment lines, a header and frame,dx,dy,da per line.
+    in.clear( );
+    in.seekg( 0 );
+    string line;
+    vector< bool > seen;
+    while( getline( in, line ) )
+    {
+        if( line.empty( ) || line[0] == 'f' )
+            continue;
+
+        if( line[0] == '#' )
+        {
+            string::size_type pAt = line.find( "frame size " );
+            if( pAt != string::npos )
+                sscanf( line.c_str( ) + pAt, "frame size %dx%d"
+                        , &frameSize.width, &frameSize.height 
+                        );
+            continue;
+        }
+
+        size_t k;
+        double dx, dy, da;
+        if( sscanf( line.c_str( ), "%zu,%lf,%lf,%lf", &k, &dx, &dy, &da ) != 4 )
+        {
+            std::cout << "[WARN] Bad line in " << filename << ": " << line << std::endl;
+            return false;
+        }
+        if( k >= corrections.size( ) )
+        {
+            corrections.resize( k + 1, TransformParam( 0, 0, 0 ) );
+            seen.resize( k + 1, false );
+        }
+        corrections[k] = TransformParam( dx, dy, da );
+        seen[k] = true;
+    }
+
+    // E.g. a hand-edited or truncated file.
+    size_t numMissing = count( seen.begin( ), seen.end( ), false );
+    if( numMissing > 0 )
+        std::cout << "[WARN] " << numMissing << " frames between 0 and " 
+            << corrections.size( ) - 1 << " are missing in " << filename 
+            << ", they are not corrected." << std::endl;
+    return true;
+}
@@ -0,0 +1,50 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  transforms.h
+ *
+ *    Description:  Read and write the per-frame corrections (sidecar file), so
+ *                  that motion estimated on one stack can be applied to others.
+ *
+ *        Version:  1.0
+ *        Created:  10/27/2016 04:40:19 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Dilawar Singh (), dilawars@ncbs.res.in
+ *   Organization:  NCBS Bangalore
+ *
+ * =====================================================================================
+ */
+
+#ifndef  transforms_INC
+#define  transforms_INC
+
+#include "stablizer.h"
+
+/**
+ * @brief Write the correction (dx, dy, da) of every frame.
+ *
+ * Files ending in .csv are written as text, one "frame,dx,dy,da" line per
+ * frame. Anything else is written in a compact binary format: the magic
+ * VSTRANS1, width and height (int32), the number of frames (uint64) and three
+ * doubles per frame, all little endian.
+ *
+ * @param filename
+ * @param corrections
+ * @param frameSize Size of the frames the corrections were estimated on.
+ */
+bool write_transforms( const string& filename
+        , const vector< TransformParam >& corrections
+        , Size frameSize 
+        );
+
+/**
+ * @brief Read corrections written by write_transforms( ).
+ */
+bool read_transforms( const string& filename
+        , vector< TransformParam >& corrections
+        , Size& frameSize 
+        );
+
+#endif   /* ----- #ifndef transforms_INC  ----- */
@@ -17,105 +17,305 @@
  */
 
 #include "videoio.h"
+#include "tiffindex.h"
+#include "arrayfile.h"
+#include "framestore.h"
+#include "globals.h"
+#include "metrics.h"
+#include "parallel.h"
 
 #include <vector>
+#include <cstring>
+#include <stdexcept>
 #include <tiffio.h>
 #include <opencv2/opencv.hpp>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 using namespace std;
 using namespace cv;
 
+// Frames copied into an ArrayFile by a thread at a time.
+const size_t ARRAY_WRITE_CHUNK = 16;
+
+/*-----------------------------------------------------------------------------
+ *  MappedFile
+ *-----------------------------------------------------------------------------*/
+MappedFile::MappedFile( ) : data_( NULL ), size_( 0 )
+{
+}
+
+MappedFile::~MappedFile( )
+{
+    close( );
+}
+
+bool MappedFile::open( const string& filename )
+{
+    close( );
+
+    int fd = ::open( filename.c_str( ), O_RDONLY );
+    if( fd < 0 )
+        return false;
+
+    struct stat st;
+    if( fstat( fd, &st ) != 0 || st.st_size == 0 )
+    {
+        ::close( fd );
+        return false;
+    }
+
+    void* addr = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    ::close( fd );
+    if( addr == MAP_FAILED )
+        return false;
+
+    // Pages are mostly read front to back.
+    madvise( addr, st.st_size, MADV_SEQUENTIAL );
+
+    data_ = ( const uchar* ) addr;
+    size_ = st.st_size;
+    return true;
+}
+
+void MappedFile::close( )
+{
+    if( data_ )
+        munmap( ( void* ) data_, size_ );
+    data_ = NULL;
+    size_ = 0;
+}
+
+/*-----------------------------------------------------------------------------
+ *  TIFF pages.
+ *-----------------------------------------------------------------------------*/
+
 /**
- * @brief  Read data from TIFF images are vector of opencv matrix.
- *
- * @tparam pixal_type_t
- * @param
- * @param
- * @param
+ * @brief OpenCV depth of the samples of the current TIFF directory, -1 if
+ * there is no matching depth.
  */
-void get_frames_from_tiff ( const string& filename
-                            , vector< Mat > & frames
-                            , video_info_t& vidInfo
-                          )
+static int tiff_page_depth( TIFF* tif )
 {
+    uint16 bps = 1, format = SAMPLEFORMAT_UINT;
+    TIFFGetFieldDefaulted( tif, TIFFTAG_BITSPERSAMPLE, &bps );
+    TIFFGetFieldDefaulted( tif, TIFFTAG_SAMPLEFORMAT, &format );
 
-#ifdef USE_LIBTIFF
-    TIFF *tif = TIFFOpen ( filename.c_str(), "r" );
+    if( format == SAMPLEFORMAT_IEEEFP )
+    {
+        if( bps == 32 )
+            return CV_32F;
+        if( bps == 64 )
+            return CV_64F;
+        return -1;
+    }
 
-    if ( tif )
+    bool isSigned = ( format == SAMPLEFORMAT_INT );
+    switch( bps )
     {
-        int dircount = 0;
+        case 8:
+            return isSigned ? CV_8S : CV_8U;
+        case 16:
+            return isSigned ? CV_16S : CV_16U;
+        case 32:
+            // OpenCV has no unsigned 32 bit type.
+            return CV_32S;
+        default:
+            return -1;
+    }
+}
 
-        do
-        {
-            dircount++;
-            uint32 w, h;
-            short bitsPerSample;
-            size_t npixals;
+/**
+ * @brief Copy uncompressed strips straight from the mapped file.
+ *
+ * @return false if the page can not be read this way.
+ */
+static bool read_tiff_page_mapped( TIFF* tif, const MappedFile& map, Mat& frame )
+{
+    uint16 compression = COMPRESSION_NONE;
+    TIFFGetFieldDefaulted( tif, TIFFTAG_COMPRESSION, &compression );
+    if( compression != COMPRESSION_NONE || TIFFIsTiled( tif ) )
+        return false;
+
+    // Multi-byte samples in the other byte order need swapping.
+    if( frame.elemSize( ) > 1 && TIFFIsByteSwapped( tif ) )
+        return false;
+
+    toff_t* offsets = NULL;
+    toff_t* byteCounts = NULL;
+    if( ! TIFFGetField( tif, TIFFTAG_STRIPOFFSETS, &offsets ) 
+            || ! TIFFGetField( tif, TIFFTAG_STRIPBYTECOUNTS, &byteCounts ) )
+        return false;
+
+    uint32 rowsPerStrip = frame.rows;
+    TIFFGetFieldDefaulted( tif, TIFFTAG_ROWSPERSTRIP, &rowsPerStrip );
+    rowsPerStrip = min( rowsPerStrip, ( uint32 ) frame.rows );
+
+    size_t rowBytes = frame.cols * frame.elemSize( );
+    uint32 numStrips = TIFFNumberOfStrips( tif );
+    for( uint32 s = 0; s < numStrips; s++ )
+    {
+        uint32 row = s * rowsPerStrip;
+        if( row >= ( uint32 ) frame.rows )
+            break;
 
-            TIFFGetField ( tif, TIFFTAG_IMAGEWIDTH, &w );
-            TIFFGetField ( tif, TIFFTAG_IMAGELENGTH, &h );
-            TIFFGetField ( tif, TIFFTAG_BITSPERSAMPLE, &bitsPerSample );
-            //std::cout << "Bits per sample " << bitsPerSample  << std::endl;
-            npixals = w * h;
+        size_t bytes = min( frame.rows - row, rowsPerStrip ) * rowBytes;
+        if( byteCounts[s] < bytes || offsets[s] + bytes > map.size( ) )
+            return false;
 
-            //std::cout << "Height : " << h << std::endl;
-            //std::cout << "Width : " << w << std::endl;
+        memcpy( frame.ptr( row ), map.data( ) + offsets[s], bytes );
+    }
+    return true;
+}
 
-            uint32* raster = ( uint32* ) _TIFFmalloc ( npixals * sizeof ( uint32 ) );
+/**
+ * @brief Decode strips or tiles into frame with libtiff.
+ */
+static bool read_tiff_page_decoded( TIFF* tif, Mat& frame )
+{
+    size_t rowBytes = frame.cols * frame.elemSize( );
 
-            if ( raster != NULL )
+    if( TIFFIsTiled( tif ) )
+    {
+        uint32 tw = 0, th = 0;
+        TIFFGetField( tif, TIFFTAG_TILEWIDTH, &tw );
+        TIFFGetField( tif, TIFFTAG_TILELENGTH, &th );
+        if( tw == 0 || th == 0 )
+            return false;
+
+        Mat tile( th, tw, frame.type( ) );
+        for( uint32 y = 0; y < ( uint32 ) frame.rows; y += th )
+            for( uint32 x = 0; x < ( uint32 ) frame.cols; x += tw )
             {
-                if ( TIFFReadRGBAImage ( tif, w, h, raster, 0 )  )
-                {
-                    Mat frame ( h, w, CV_16U );
-
-                    for ( size_t i = 0; i < h; i++ )
-                        for ( size_t ii = 0; ii < w; ii++ )
-                            frame.at<uint16> ( i, ii ) = ( uint16 ) ( raster[i*w+ii] );
-
-                    frames.push_back ( frame );
-                }
+                ttile_t t = TIFFComputeTile( tif, x, y, 0, 0 );
+                if( TIFFReadEncodedTile( tif, t, tile.data, tile.total( ) * tile.elemSize( ) ) < 0 )
+                    return false;
+
+                // Tiles on the right and bottom edge are padded.
+                int cw = min( tw, frame.cols - x );
+                int ch = min( th, frame.rows - y );
+                tile( Rect( 0, 0, cw, ch ) ).copyTo( frame( Rect( x, y, cw, ch ) ) );
             }
-        }
-        while ( TIFFReadDirectory ( tif ) );
+        return true;
     }
 
-    TIFFClose ( tif );
+    uint32 rowsPerStrip = frame.rows;
+    TIFFGetFieldDefaulted( tif, TIFFTAG_ROWSPERSTRIP, &rowsPerStrip );
+    rowsPerStrip = min( rowsPerStrip, ( uint32 ) frame.rows );
 
-#else
-    imreadmulti ( String ( filename.c_str() )
-                  , frames
-                  , IMREAD_ANYDEPTH
-                );
-#endif
+    // Strips are whole rows, so they decode directly into the frame.
+    uint32 numStrips = TIFFNumberOfStrips( tif );
+    for( uint32 s = 0; s < numStrips; s++ )
+    {
+        uint32 row = s * rowsPerStrip;
+        if( row >= ( uint32 ) frame.rows )
+            break;
 
+        size_t bytes = min( frame.rows - row, rowsPerStrip ) * rowBytes;
+        if( TIFFReadEncodedStrip( tif, s, frame.ptr( row ), bytes ) < 0 )
+            return false;
+    }
+    return true;
+}
 
-    /*-----------------------------------------------------------------------------
-     *  Normalize each frame such that values are between 0 and 255.
-     *-----------------------------------------------------------------------------*/
-    double maxPixalValue = 0;
-    double minVal , maxVal;
-    Point minLoc, maxLoc;
+/**
+ * @brief Pages which are not single channel 8/16/32/64 bit (colour, palette,
+ * 1 or 12 bit ...) are expanded to RGBA by libtiff and converted to grey.
+ */
+static bool read_tiff_page_rgba( TIFF* tif, uint32 w, uint32 h, Mat& frame )
+{
+    Mat rgba( h, w, CV_8UC4 );
+    if( ! TIFFReadRGBAImageOriented( tif, w, h, ( uint32* ) rgba.data, ORIENTATION_TOPLEFT, 0 ) )
+        return false;
+
+    cvtColor( rgba, frame, COLOR_RGBA2GRAY );
+    return true;
+}
 
-    for ( size_t i = 0; i < frames.size(); i++ )
+bool read_tiff_page( TIFF* tif, Mat& frame, const MappedFile* map )
+{
+    uint32 w = 0, h = 0;
+    uint16 spp = 1, planar = PLANARCONFIG_CONTIG, photometric = PHOTOMETRIC_MINISBLACK;
+
+    TIFFGetField ( tif, TIFFTAG_IMAGEWIDTH, &w );
+    TIFFGetField ( tif, TIFFTAG_IMAGELENGTH, &h );
+    TIFFGetFieldDefaulted ( tif, TIFFTAG_SAMPLESPERPIXEL, &spp );
+    TIFFGetFieldDefaulted ( tif, TIFFTAG_PLANARCONFIG, &planar );
+    TIFFGetFieldDefaulted ( tif, TIFFTAG_PHOTOMETRIC, &photometric );
+    if( w == 0 || h == 0 )
+        return false;
+
+    int depth = tiff_page_depth( tif );
+    bool grey = ( photometric == PHOTOMETRIC_MINISBLACK || photometric == PHOTOMETRIC_MINISWHITE );
+    if( depth < 0 || spp != 1 || ! grey )
+        return read_tiff_page_rgba( tif, w, h, frame );
+
+    // A continuous frame of the depth stored in the file. A frame which
+    // already has that size and type, e.g. a view of a FrameStore, is
+    // decoded into in place.
+    frame.create( h, w, CV_MAKETYPE( depth, 1 ) );
+
+    if( ! ( map && map->data( ) && read_tiff_page_mapped( tif, *map, frame ) )
+            && ! read_tiff_page_decoded( tif, frame ) )
+        return false;
+
+    // Frames are written MINISBLACK, so 0 must be black here too. For
+    // unsigned pixels, not( x ) is max - x.
+    if( photometric == PHOTOMETRIC_MINISWHITE )
     {
-        minMaxLoc ( frames[i], &minVal, &maxVal, &minLoc, &maxLoc );
+        if( depth == CV_32F || depth == CV_64F )
+            frame.convertTo( frame, -1, -1.0 );
+        else
+            bitwise_not( frame, frame );
+    }
+    return true;
+}
 
-        if ( maxVal > maxPixalValue )
-            maxPixalValue = maxVal;
+void ByteView::convert( const Mat& frame, Mat& view )
+{
+    if( frame.depth( ) == CV_8U )
+    {
+        view = frame;
+        return;
     }
 
-    // Now rescale every frame to get the value between 0 and 255.
-    if ( maxPixalValue > 255.0 )
+    if( scale_ == 0 )
     {
-        for ( size_t i = 0; i < frames.size(); i++ )
-        {
-            Mat frame = frames[i];
-            frame.convertTo ( frame, CV_8U, 255.0 / maxPixalValue );
-            frames[i] = frame;
-        }
+        double minVal, maxVal;
+        minMaxLoc( frame, &minVal, &maxVal );
+        scale_ = maxVal > 0 ? 255.0 / maxVal : 1.0;
     }
+    frame.convertTo( view, CV_8U, scale_ );
+}
+
+/**
+ * @brief  Read data from TIFF images are vector of opencv matrix.
+ *
+ * @tparam pixal_type_t
+ * @param
+ * @param
+ * @param
+ */
+void get_frames_from_tiff ( const string& filename
+                            , vector< Mat > & frames
+                            , video_info_t& vidInfo
+                          )
+{
+
+#ifdef USE_LIBTIFF
+    TiffIndex index;
+    if ( index.build ( filename ) )
+        read_tiff_frames ( index, 0, index.size( ), frames );
+
+#else
+    imreadmulti ( String ( filename.c_str() )
+                  , frames
+                  , IMREAD_ANYDEPTH
+                );
+#endif
+
 
 #if 0
 
@@ -171,6 +371,7 @@ void read_frames ( const string& filename
                    , video_info_t& vidInfo
                  )
 {
+    StageTimer timer( "read" );
 
     string::size_type pAt = filename.find_last_of ( '.' );
     string ext = filename.substr ( pAt + 1 );
@@ -184,28 +385,75 @@ void read_frames ( const string& filename
 
 }
 
-void write_frames( 
-        const string& outfile                   /* Output file */
-        , const vector< Mat > frames            /* All the frames */
-        , const string& infile                  /* Input file. */
-        )
+void read_frames ( const string& filename
+                   , FrameStore& store
+                   , vector< Mat >& frames
+                   , video_info_t& vidInfo
+                 )
 {
-    // Get the extension of file.
-    size_t lastDotPos = outfile.find_last_of( '.' );
-    string ext = outfile.substr( lastDotPos + 1 );
-    if( ext.size( ) < 1 )
+    StageTimer timer( "read" );
+    frames.clear( );
+
+    string ext = file_extension( filename );
+    if ( ext == "tif" || ext == "tiff" )
     {
-        std::cout << "[WARN] I could not determine file type,"
-            << " I am going to use avi format"
-            << std::endl;
-        ext = string("avi");
+        // The first page gives the size and type of all of them.
+        TiffIndex index;
+        vector< Mat > first;
+        if( index.build( filename ) )
+            read_tiff_frames( index, 0, 1, first );
+        if( first.empty( ) )
+        {
+            std::cout << "Could not read " << filename << std::endl;
+            return;
+        }
+        if( ! store.allocate( index.size( ), first[0].size( ), first[0].type( ) ) )
+            return;
+
+        frames = store.frames( );
+        if( ! read_tiff_frames_into( index, 0, frames ) )
+            std::cout << "[WARN] Some pages of " << filename << " could not be read"
+                << " or differ from the first one." << std::endl;
+    }
+    else
+    {
+        // The number of frames of a video is only an estimate.
+        FrameReader reader;
+        Mat frame;
+        if( ! reader.open( filename, vidInfo ) || ! reader.read( frame ) )
+            return;
+        if( ! store.allocate( max( ( size_t ) 1, vidInfo.numFrames ), frame.size( ), frame.type( ) ) )
+            return;
+
+        size_t n = 0;
+        do
+        {
+            if( n == store.size( ) && ! store.resize( n + n / 2 + 1 ) )
+                break;
+            Mat view = store.frame( n++ );
+            frame.copyTo( view );
+        } while( reader.read( frame ) );
+
+        store.resize( n );
+        frames = store.frames( );
     }
 
-    STRTOLOWER( ext );
-    if( ext == "tiff" || ext == "tif" )
-        return write_frames_to_tiff( outfile, frames, infile );
+    vidInfo.width = frames[0].cols;
+    vidInfo.height = frames[0].rows;
+    vidInfo.numFrames = frames.size( );
+    cout << "[INFO] Read " << frames.size() << " frames from " << filename << endl;
+}
 
-    // Now file type is determined, use opencv to get fps and fourcc codec from file.
+/**
+ * @brief Open a video writer using the frame rate and codec of infile.
+ */
+static bool open_video_writer( VideoWriter& writer
+        , const string& outfile
+        , const string& infile
+        , Size frameSize
+        )
+{
+    // Use opencv to get fps and fourcc codec from file.
     VideoCapture in( infile );
 #ifdef USE_OPENCV3
     double fps = in.get( CAP_PROP_FPS );        /* Get frame rate */
@@ -236,6 +484,48 @@ void write_frames(
     
     in.release( );                                /* Close the input file. */
 
+    writer.open ( outfile, fourcc, fps, frameSize, true );
+    return writer.isOpened( );
+}
+
+string file_extension( const string& filename )
+{
+    size_t lastDotPos = filename.find_last_of( '.' );
+    if( lastDotPos == string::npos )
+        return string( "" );
+
+    string ext = filename.substr( lastDotPos + 1 );
+    STRTOLOWER( ext );
+    return ext;
+}
+
+void write_frames( 
+        const string& outfile                   /* Output file */
+        , const vector< Mat > frames            /* All the frames */
+        , const string& infile                  /* Input file. */
+        )
+{
+    StageTimer timer( "write" );
+
+    // Get the extension of file.
+    string ext = file_extension( outfile );
+    if( ext.size( ) < 1 )
+    {
+        std::cout << "[WARN] I could not determine file type,"
+            << " I am going to use avi format"
+            << std::endl;
+        ext = string("avi");
+    }
+
+    if( ext == "tiff" || ext == "tif" )
+    {
+        if( ! write_frames_to_tiff( outfile, frames, infile ) )
+            throw runtime_error( "could not write " + outfile );
+        return;
+    }
+
+    if( is_array_file( outfile ) )
+        return write_frames_to_array( outfile, frames );
 
     /*-----------------------------------------------------------------------------
      *  Start writing to output file.
@@ -243,14 +533,15 @@ void write_frames(
     VideoWriter writer;
     Size frameSize ( frames[0].cols, frames[0].rows ); /* Frame size */
 
-    writer.open ( outfile, fourcc, fps, frameSize, true );
-    if ( writer.isOpened() )
+    if ( open_video_writer( writer, outfile, infile, frameSize ) )
     {
+        ByteView byteView;
         for ( size_t i = 0; i < frames.size(); i ++ )
         {
             // Convert frame from greyscale to color before writing.
-            Mat colorFrame;
-            cvtColor( frames[i], colorFrame, CV_GRAY2BGR );
+            Mat view, colorFrame;
+            byteView.convert( frames[i], view );
+            cvtColor( view, colorFrame, CV_GRAY2BGR );
             writer << colorFrame;
         }
         writer.release( );
@@ -260,6 +551,112 @@ void write_frames(
         << outfile << endl;
 }
 
+/**
+ * @brief Compression scheme selected by tiff_compression_. Falls back to no
+ * compression if libtiff was built without the codec.
+ */
+static uint16 tiff_compression( )
+{
+    uint16 scheme = COMPRESSION_NONE;
+    if( tiff_compression_ == "lzw" )
+        scheme = COMPRESSION_LZW;
+    else if( tiff_compression_ == "deflate" )
+        scheme = COMPRESSION_ADOBE_DEFLATE;
+#ifdef COMPRESSION_ZSTD
+    else if( tiff_compression_ == "zstd" )
+        scheme = COMPRESSION_ZSTD;
+#endif
+    else if( tiff_compression_ != "none" )
+        std::cout << "[WARN] Unknown compression " << tiff_compression_ 
+            << ", writing uncompressed frames." << std::endl;
+
+    if( scheme != COMPRESSION_NONE && ! TIFFIsCODECConfigured( scheme ) )
+    {
+        std::cout << "[WARN] libtiff does not support " << tiff_compression_ 
+            << " compression, writing uncompressed frames." << std::endl;
+        scheme = COMPRESSION_NONE;
+    }
+    return scheme;
+}
+
+/**
+ * @brief Open a TIFF file for writing. Classic TIFF can not address more than
+ * 4 GB, so BigTIFF is used when the (uncompressed) size of the frames may
+ * exceed it.
+ *
+ * @param outfile
+ * @param numBytes Expected size of all frames, 0 if not known.
+ */
+static TIFF* open_tiff_writer( const string& outfile, uint64 numBytes )
+{
+    // Leave room for the directories.
+    const uint64 classicLimit = ( ( uint64 ) 1 << 32 ) - ( ( uint64 ) 1 << 26 );
+    bool bigTiff = ( numBytes == 0 || numBytes > classicLimit );
+
+    TIFF* out = TIFFOpen( outfile.c_str( ), bigTiff ? "w8" : "w" );
+    if( ! out )
+    {
+        std::cout << "Can't open tiff file to open : " << outfile << std::endl;
+        return NULL;
+    }
+
+    if( bigTiff && verbose_flag_ )
+        std::cout << "[INFO] Writing BigTIFF to " << outfile << std::endl;
+    return out;
+}
+
+bool write_tiff_page( TIFF* out, const Mat& frame, size_t pageNum, size_t numPages
+        , uint16 compression 
+        )
+{
+    uint32 height = frame.rows;
+    uint32 width = frame.cols;
+    int depth = frame.depth( );
+
+    TIFFSetField( out, TIFFTAG_SUBFILETYPE, FILETYPE_PAGE);
+    // Both are uint16, and passed through varargs.
+    TIFFSetField( out, TIFFTAG_PAGENUMBER, ( uint16 ) min( pageNum, ( size_t ) 65535 )
+            , ( uint16 ) min( numPages, ( size_t ) 65535 ) 
+            );
+
+    TIFFSetField ( out, TIFFTAG_IMAGEWIDTH, width );
+    TIFFSetField ( out, TIFFTAG_IMAGELENGTH, height);
+    TIFFSetField ( out, TIFFTAG_SAMPLESPERPIXEL, ( uint16 ) frame.channels( ) );
+    TIFFSetField ( out, TIFFTAG_BITSPERSAMPLE, ( uint16 ) ( 8 * frame.elemSize1( ) ) );
+
+    uint16 format = SAMPLEFORMAT_UINT;
+    if( depth == CV_8S || depth == CV_16S || depth == CV_32S )
+        format = SAMPLEFORMAT_INT;
+    else if( depth == CV_32F || depth == CV_64F )
+        format = SAMPLEFORMAT_IEEEFP;
+    TIFFSetField ( out, TIFFTAG_SAMPLEFORMAT, format );
+
+    TIFFSetField ( out, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT ); 
+    TIFFSetField ( out, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG );
+    TIFFSetField ( out, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK );
+
+    TIFFSetField ( out, TIFFTAG_COMPRESSION, compression );
+    if( compression != COMPRESSION_NONE && format != SAMPLEFORMAT_IEEEFP )
+        TIFFSetField ( out, TIFFTAG_PREDICTOR, PREDICTOR_HORIZONTAL );
+
+    // Rows are written a whole strip of about TIFF_STRIP_BYTES at a time.
+    size_t rowBytes = frame.cols * frame.elemSize( );
+    uint32 rowsPerStrip = max( ( size_t ) 1, TIFF_STRIP_BYTES / max( rowBytes, ( size_t ) 1 ) );
+    rowsPerStrip = min( rowsPerStrip, height );
+    TIFFSetField ( out, TIFFTAG_ROWSPERSTRIP, rowsPerStrip );
+
+    // Rows of a ROI are not contiguous.
+    Mat data = frame.isContinuous( ) ? frame : frame.clone( );
+    uint32 strip = 0;
+    for( uint32 r = 0; r < height; r += rowsPerStrip, strip++ )
+    {
+        uint32 rows = min( rowsPerStrip, height - r );
+        if( TIFFWriteEncodedStrip( out, strip, data.ptr( r ), rows * rowBytes ) < 0 )
+            return false;
+    }
+
+    return TIFFWriteDirectory( out ) != 0;
+}
 
 /**
  * @brief Write frames to tiff file.
@@ -267,68 +664,351 @@ void write_frames(
  * @param 
  * @param {
  */
-void write_frames_to_tiff ( const string& outfile
+bool write_frames_to_tiff ( const string& outfile
         , const vector< Mat > frames
         , const string& infile 
         )
 {
-    // Open the tiff file and create tags from the infile.
-    TIFF* out = TIFFOpen ( outfile.c_str(), "w" );
-    TIFF* in = TIFFOpen( infile.c_str(), "r" );
+    uint64 numBytes = 0;
+    for( auto& f : frames )
+        numBytes += f.total( ) * f.elemSize( );
 
+    TIFF* out = open_tiff_writer( outfile, numBytes );
     if( ! out )
+        return false;
+
+    uint16 compression = tiff_compression( );
+    for (size_t frameNum = 0; frameNum < frames.size(); frameNum++) 
     {
-        std::cout << "Can't open tiff file to open : " << outfile << std::endl;
+        if( ! write_tiff_page( out, frames[frameNum], frameNum, frames.size( ), compression ) )
+        {
+            std::cout << "[WARN] Could not write frame " << frameNum << " to " 
+                << outfile << std::endl;
+            TIFFClose( out );
+            return false;
+        }
+    }
+
+    TIFFClose( out );
+    std::cout << "[INFO] Wrote frames to " << outfile << std::endl;
+    return true;
+}
+
+void write_frames_to_array( const string& outfile, const vector< Mat >& frames )
+{
+    if( frames.empty( ) )
         return;
+
+    ArrayFile out;
+    if( ! out.create( outfile, frames.size( ), frames[0].size( ), frames[0].type( ) ) )
+        return;
+
+    // Frames are at fixed offsets, copy them in parallel.
+    parallel_for( frames.size( ), ARRAY_WRITE_CHUNK, [&]( size_t begin, size_t end )
+            {
+                for( size_t k = begin; k < end; k++ )
+                {
+                    Mat view = out.frame( k );
+                    frames[k].copyTo( view );
+                }
+            }
+        );
+
+    out.close( );
+    std::cout << "[INFO] Wrote frames to " << outfile << std::endl;
+}
+
+/*-----------------------------------------------------------------------------
+ *  FrameReader
+ *-----------------------------------------------------------------------------*/
+FrameReader::FrameReader( ) : 
+    tif_( NULL )
+    , next_( 0 )
+    , isTiff_( false )
+    , done_( true )
+    , frameType_( CV_8UC1 )
+{
+}
+
+FrameReader::~FrameReader( )
+{
+    close( );
+}
+
+bool FrameReader::open( const string& filename, video_info_t& vidInfo )
+{
+    close( );
+
+    string ext = file_extension( filename );
+    isTiff_ = ( ext == "tif" || ext == "tiff" );
+
+    if( isTiff_ )
+    {
+        index_.reset( new TiffIndex( ) );
+        tif_ = TIFFOpen( filename.c_str( ), "r" );
+        if( ! tif_ || ! index_->build( filename ) )
+        {
+            std::cout << "Could not open " << filename << std::endl;
+            return false;
+        }
+        map_.open( filename );
+        vidInfo.numFrames = index_->size( );
+
+        uint32 w = 0, h = 0;
+        if( seek_tiff_page( tif_, *index_, 0 ) )
+        {
+            TIFFGetField( tif_, TIFFTAG_IMAGEWIDTH, &w );
+            TIFFGetField( tif_, TIFFTAG_IMAGELENGTH, &h );
+        }
+        vidInfo.width = w;
+        vidInfo.height = h;
+        seek( 0 );
+        return true;
     }
 
-    if( ! in )
+    if( ! cap_.open( filename ) )
     {
-        std::cout << "Can't open " << infile << " for reading tags" << std::endl;
-        return;
+        std::cout << "Could not open " << filename << std::endl;
+        return false;
     }
 
-    uint32 height, width;
-    uint16 spp, bpp;
+    vidInfo.width = ( int ) cap_.get ( CV_CAP_PROP_FRAME_WIDTH );
+    vidInfo.height = ( int ) cap_.get ( CV_CAP_PROP_FRAME_HEIGHT );
+    vidInfo.numFrames = max( 0.0, cap_.get ( CV_CAP_PROP_FRAME_COUNT ) );
+    done_ = false;
+    return true;
+}
+
+bool FrameReader::seek( size_t frameNum )
+{
+    if( ! isTiff_ || ! index_ || frameNum >= index_->size( ) )
+        return false;
+
+    next_ = frameNum;
+    done_ = false;
+    return true;
+}
+
+size_t FrameReader::numFrames( ) const
+{
+    return index_ ? index_->size( ) : 0;
+}
 
-    for (uint16 frameNum = 0; frameNum < frames.size(); frameNum++) 
+bool open_reader_at( FrameReader& reader, const string& infile, size_t frame )
+{
+    video_info_t vInfo;
+    if( ! reader.open( infile, vInfo ) )
+        return false;
+    if( frame == 0 )
+        return true;
+    if( reader.numFrames( ) > 0 )
+        return reader.seek( frame );
+
+    // Not seekable: read and drop the frames before.
+    Mat skipped;
+    for( size_t i = 0; i < frame; i++ )
+        if( ! reader.read( skipped ) )
+            return false;
+    return true;
+}
+
+bool FrameReader::read( Mat& frame )
+{
+    StageTimer timer( "read" );
+    while( ! done_ )
     {
-        TIFFSetField( out, TIFFTAG_SUBFILETYPE, FILETYPE_PAGE);
-        TIFFSetField( out, TIFFTAG_PAGENUMBER, frameNum, frames.size( ) );
+        if( ! isTiff_ )
+        {
+            Mat cur;
+            cap_ >> cur;
+            if( cur.data == NULL )
+            {
+                done_ = true;
+                break;
+            }
+            // Not into frame, the caller may still hold its buffer.
+            Mat grey;
+            cvtColor ( cur, grey, COLOR_BGR2GRAY );
+            frame = grey;
+            return true;
+        }
+
+        set_current_frame( next_ );
+        Mat page;
+        bool found = seek_tiff_page( tif_, *index_, next_ );
+        bool ok = found && read_tiff_page( tif_, page, &map_ );
+        size_t pageNum = next_;
+        next_ += 1;
+        done_ = next_ >= index_->size( );
+
+        if( ok )
+        {
+            frameSize_ = page.size( );
+            frameType_ = page.type( );
+            frame = page;
+            return true;
+        }
+
+        // Frames are counted by position (transforms, checkpoints, chunks),
+        // so a page which can not be decoded is replaced by a black frame of
+        // the size of the others rather than skipped.
+        if( frameSize_.area( ) == 0 && found )
+        {
+            uint32 w = 0, h = 0;
+            TIFFGetField( tif_, TIFFTAG_IMAGEWIDTH, &w );
+            TIFFGetField( tif_, TIFFTAG_IMAGELENGTH, &h );
+            int depth = tiff_page_depth( tif_ );
+            frameSize_ = Size( w, h );
+            frameType_ = CV_MAKETYPE( depth < 0 ? CV_8U : depth, 1 );
+        }
+        if( frameSize_.area( ) == 0 )
+        {
+            std::cout << "[WARN] Could not read page " << pageNum << " of " 
+                << index_->filename( ) << std::endl;
+            done_ = true;
+            break;
+        }
 
-        TIFFGetField(in, TIFFTAG_IMAGEWIDTH, &width);
-        TIFFSetField ( out, TIFFTAG_IMAGEWIDTH, width );
+        std::cout << "[WARN] Could not read page " << pageNum << " of " 
+            << index_->filename( ) << ", it is replaced by a black frame." << std::endl;
+        record_event( "unreadable_page" );
+        frame = Mat::zeros( frameSize_, frameType_ );
+        return true;
+    }
+    return false;
+}
+
+void FrameReader::close( )
+{
+    if( tif_ )
+        TIFFClose( tif_ );
+    tif_ = NULL;
+    map_.close( );
+    index_.reset( );
+    next_ = 0;
+    frameSize_ = Size( );
+
+    if( cap_.isOpened( ) )
+        cap_.release( );
+    done_ = true;
+}
 
-        TIFFGetField( in, TIFFTAG_IMAGELENGTH, &height);
-        TIFFSetField ( out, TIFFTAG_IMAGELENGTH, height);
+/*-----------------------------------------------------------------------------
+ *  FrameWriter
+ *-----------------------------------------------------------------------------*/
+FrameWriter::FrameWriter( ) :
+    tif_( NULL )
+    , isTiff_( false )
+    , compression_( COMPRESSION_NONE )
+    , expectedFrames_( 0 )
+    , numFrames_( 0 )
+{
+}
 
-        TIFFGetField( in, TIFFTAG_SAMPLESPERPIXEL, &spp );
-        TIFFSetField ( out, TIFFTAG_SAMPLESPERPIXEL, spp);
+FrameWriter::~FrameWriter( )
+{
+    close( );
+}
 
-        TIFFGetField( in, TIFFTAG_BITSPERSAMPLE, &bpp );
-        TIFFSetField ( out, TIFFTAG_BITSPERSAMPLE, 8 );
+bool FrameWriter::open( const string& outfile, const string& infile
+        , size_t expectedFrames 
+        , size_t firstFrame
+        )
+{
+    close( );
+
+    outfile_ = outfile;
+    infile_ = infile;
+    expectedFrames_ = expectedFrames;
+    numFrames_ = firstFrame;
+
+    string ext = file_extension( outfile );
+    isTiff_ = ( ext == "tif" || ext == "tiff" );
+    array_.reset( is_array_file( outfile ) ? new ArrayFile( ) : NULL );
+    if( isTiff_ )
+        compression_ = tiff_compression( );
+    else if( firstFrame > 0 )
+    {
+        std::cout << "[WARN] Can not append to " << outfile << ", only to TIFF"
+            << " files." << std::endl;
+        return false;
+    }
+    return true;
+}
 
-        TIFFSetField ( out, TIFFTAG_ORIENTATION, ORIENTATION_BOTLEFT ); 
-        TIFFSetField ( out, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG );
-        TIFFSetField ( out, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK );
+bool FrameWriter::write( const Mat& frame )
+{
+    StageTimer timer( "write" );
+    set_current_frame( numFrames_ );
+    if( isTiff_ )
+    {
+        // libtiff keeps the format (classic or BigTIFF) of a file it appends
+        // to.
+        if( ! tif_ && numFrames_ > 0 )
+            tif_ = TIFFOpen( outfile_.c_str( ), "a" );
+        else if( ! tif_ )
+            tif_ = open_tiff_writer( outfile_
+                    , expectedFrames_ * frame.total( ) * frame.elemSize( ) 
+                    );
+        if( ! tif_ )
+            return false;
+        if( ! write_tiff_page( tif_, frame, numFrames_, expectedFrames_, compression_ ) )
+        {
+            std::cout << "[WARN] Could not write frame " << numFrames_ << " to " 
+                << outfile_ << std::endl;
+            return false;
+        }
+        numFrames_ += 1;
+        return true;
+    }
 
-        Mat frame = frames[frameNum];
-        // We set the strip size of the file to be size of one row of pixels
-        //TIFFSetField(out, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(out, width*spp));
+    if( array_ )
+    {
+        // Grow by half when the recording is longer than expected, the file
+        // is cut to the frames written in close( ).
+        if( ! array_->isOpen( ) )
+        {
+            if( ! array_->create( outfile_, max( expectedFrames_, ( size_t ) 1 )
+                        , frame.size( ), frame.type( ) ) )
+                return false;
+        }
+        else if( numFrames_ >= array_->numFrames( ) )
+        {
+            if( ! array_->resize( numFrames_ + numFrames_ / 2 + 1 ) )
+                return false;
+        }
 
-        // Data type matching.
-        unsigned char* row = frame.data;
-        // See http://opencv-users.1802565.n2.nabble.com/Mat-class-with-unsigned-int-type-or-long-int-type-td7197221.html
-        for( uint16 c = 0; c < height; c ++ )
-            TIFFWriteScanline( out, &row[c*width], c, 0);
-            
-        TIFFWriteDirectory( out );
+        Mat view = array_->frame( numFrames_ );
+        frame.copyTo( view );
+        numFrames_ += 1;
+        return true;
     }
 
-    // Close the infile.
-    TIFFClose( in );
-    TIFFClose( out );
-    std::cout << "[INFO] Wrote frames to " << outfile << std::endl;
+    if( ! writer_.isOpened( ) )
+        if( ! open_video_writer( writer_, outfile_, infile_, frame.size( ) ) )
+            return false;
+
+    // Convert frame from greyscale to color before writing.
+    Mat view, colorFrame;
+    byteView_.convert( frame, view );
+    cvtColor( view, colorFrame, CV_GRAY2BGR );
+    writer_ << colorFrame;
+    numFrames_ += 1;
+    return true;
 }
 
+void FrameWriter::close( )
+{
+    if( tif_ )
+        TIFFClose( tif_ );
+    tif_ = NULL;
 
+    if( array_ && array_->isOpen( ) )
+    {
+        array_->resize( numFrames_ );
+        array_->close( );
+    }
+
+    if( writer_.isOpened( ) )
+        writer_.release( );
+}
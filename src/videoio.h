@@ -21,6 +21,8 @@
 #define  videoio_INC
 
 #include <vector>
+#include <string>
+#include <memory>
 #include <tiffio.h>
 #include <opencv2/opencv.hpp>
 
@@ -41,6 +43,95 @@ typedef struct VideoInfo
     size_t numFrames = 0;
 } video_info_t;
 
+/**
+ * @brief Read-only memory map of a whole file.
+ */
+class MappedFile
+{
+public:
+    MappedFile( );
+    ~MappedFile( );
+
+    bool open( const string& filename );
+    void close( );
+
+    const uchar* data( ) const { return data_; }
+    size_t size( ) const { return size_; }
+
+private:
+    MappedFile( const MappedFile& );
+    MappedFile& operator=( const MappedFile& );
+
+    const uchar* data_;
+    size_t size_;
+};
+
+/**
+ * @brief 8 bit view of frames of any depth, for the few consumers which need
+ * one (optical flow, AVI encoders). Frames are kept at their own depth
+ * everywhere else.
+ *
+ * The scale is fixed by the first frame converted so that all frames are
+ * scaled alike; pixels brighter than the first frame's maximum saturate. 8 bit
+ * frames are passed through without a copy.
+ */
+class ByteView
+{
+public:
+    ByteView( ) : scale_( 0 ) { }
+
+    void reset( ) { scale_ = 0; }
+    void convert( const Mat& frame, Mat& view );
+
+private:
+    double scale_;
+};
+
+/**
+ * @brief Decode the current directory (page) of an open TIFF file.
+ *
+ * Grey pages are decoded strip by strip (or tile by tile) straight into a
+ * frame of the depth stored in the file: 8, 16, 32 bit integer or 32/64 bit
+ * float. Uncompressed strips are copied from map when it is given. Any other
+ * page is expanded to RGBA by libtiff and converted to 8 bit grey.
+ * MINISWHITE pages are inverted, so that 0 is black like in the frames we
+ * write.
+ *
+ * @param tif
+ * @param frame Decoded in place when it has the size and type of the page,
+ * otherwise newly allocated.
+ * @param map Optional memory map of the same file.
+ *
+ * @return false if the page could not be decoded.
+ */
+bool read_tiff_page( TIFF* tif, Mat& frame, const MappedFile* map = NULL );
+
+// Size of the strips written to TIFF files.
+const size_t TIFF_STRIP_BYTES = 256 * 1024;
+
+/**
+ * @brief Write one frame as a page of an open TIFF file.
+ *
+ * The frame is written at its own depth (8, 16, 32 bit integer or float), a
+ * strip of several rows at a time.
+ *
+ * @param out
+ * @param frame
+ * @param pageNum Index of this page.
+ * @param numPages Total number of pages, 0 if not known yet.
+ * @param compression COMPRESSION_NONE, COMPRESSION_LZW, ...
+ *
+ * @return false if libtiff could not write the page, e.g. the disk is full.
+ */
+bool write_tiff_page( TIFF* out, const Mat& frame, size_t pageNum, size_t numPages
+        , uint16 compression = COMPRESSION_NONE
+        );
+
+/**
+ * @brief Return lowercase extension of the file name, empty if there is none.
+ */
+string file_extension( const string& filename );
+
 /**
  * @brief  Read data from TIFF images are vector of opencv matrix.
  *
@@ -64,7 +155,23 @@ void read_frames ( const string& filename
                    , video_info_t& vidInfo
                  );
 
+class FrameStore;
+
+/**
+ * @brief Read all frames into store, which is allocated for them. frames are
+ * views of store. Pages of TIFF files are decoded in place, in parallel.
+ */
+void read_frames ( const string& filename
+                   , FrameStore& store
+                   , vector< Mat >& frames
+                   , video_info_t& vidInfo
+                 );
 
+/**
+ * @brief Write frames to outfile, in the format of its extension.
+ *
+ * Throws runtime_error if TIFF output could not be written completely.
+ */
 void write_frames( 
         const string& outfile                   /* Output file */
         , const vector< Mat > frames            /* All the frames */
@@ -76,10 +183,112 @@ void write_frames(
  *
  * @param 
  * @param {
+ *
+ * @return false if a page could not be written.
  */
-void write_frames_to_tiff ( const string& outfile
+bool write_frames_to_tiff ( const string& outfile
         , const vector< Mat > frames
         , const string& infile 
         );
 
+/**
+ * @brief Write frames to a .npy or .raw file, see ArrayFile.
+ */
+void write_frames_to_array( const string& outfile, const vector< Mat >& frames );
+
+class TiffIndex;
+class ArrayFile;
+
+/**
+ * @brief Read a video one frame at a time.
+ *
+ * Unlike read_frames( ), only the frame being returned is kept in memory. Each
+ * call to read( ) hands out a freshly allocated Mat, so it is safe to hold on
+ * to previous frames.
+ *
+ * Pages of a TIFF file are read through a TiffIndex, so seek( ) to any frame
+ * is cheap. A page which can not be decoded is read as a black frame, so that
+ * frames keep their index.
+ */
+class FrameReader
+{
+public:
+    FrameReader( );
+    ~FrameReader( );
+
+    bool open( const string& filename, video_info_t& vidInfo );
+    bool read( Mat& frame );
+    void close( );
+
+    // Only for TIFF files; numFrames( ) is 0 otherwise.
+    bool seek( size_t frameNum );
+    size_t numFrames( ) const;
+
+private:
+    TIFF* tif_;
+    MappedFile map_;
+    unique_ptr< TiffIndex > index_;
+    size_t next_;
+    VideoCapture cap_;
+    bool isTiff_;
+    bool done_;
+    Size frameSize_;                            /* Of the last page read. */
+    int frameType_;
+};
+
+/**
+ * @brief Open infile so that the next frame read is frame. Files which are not
+ * seekable (e.g. avi) are read up to it.
+ */
+bool open_reader_at( FrameReader& reader, const string& infile, size_t frame );
+
+/**
+ * @brief Write a video one frame at a time.
+ *
+ * The output is opened on the first call to write( ) since the frame size is
+ * not known before that. TIFF output is BigTIFF unless expectedFrames is given
+ * and the frames fit in 4 GB.
+ *
+ * With firstFrame > 0, outfile already holds that many frames (e.g. from an
+ * interrupted run) and the new ones are appended. Only TIFF output can be
+ * appended to.
+ *
+ * .npy and .raw output is an ArrayFile of expectedFrames frames, grown if
+ * more are written.
+ */
+class FrameWriter
+{
+public:
+    FrameWriter( );
+    ~FrameWriter( );
+
+    bool open( const string& outfile, const string& infile
+            , size_t expectedFrames = 0 
+            , size_t firstFrame = 0
+            );
+
+    /**
+     * @brief Append frame.
+     *
+     * @return false if the output could not be opened or written, e.g. the
+     * disk is full.
+     */
+    bool write( const Mat& frame );
+    void close( );
+
+    size_t numFrames( ) const { return numFrames_; }
+
+private:
+    string outfile_;
+    string infile_;
+    TIFF* tif_;
+    VideoWriter writer_;
+    unique_ptr< ArrayFile > array_;
+    ByteView byteView_;
+    bool isTiff_;
+    uint16 compression_;
+    size_t expectedFrames_;
+    size_t numFrames_;
+};
+
 #endif   /* ----- #ifndef videoio_INC  ----- */